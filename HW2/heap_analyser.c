@@ -0,0 +1,502 @@
+/* Offline analyser of heap dumps written by the runtime (see "Heap dump" in runtime/gc.h).
+
+   Builds the dominator tree of the object graph with the Lengauer-Tarjan algorithm: a
+   virtual node points to every root slot, a root slot points to its object. The retained
+   size of an object is the total size of the objects it dominates, i.e. of the memory
+   which would be freed if the object became unreachable. Reports retained sizes per
+   constructor tag (objects dominated by an object of the same tag are not counted twice)
+   and the roots which retain the most memory.
+
+   Usage: heap_analyser <dump> [number of roots to report] */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "runtime/gc.h"
+
+#define NONE UINT32_MAX
+
+static void fail(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "ERROR: ");
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    exit(1);
+}
+
+static void *grow(void *array, size_t *capacity, const size_t needed, const size_t element_size) {
+    if (needed <= *capacity) {
+        return array;
+    }
+    *capacity = MAX(2 * *capacity, MAX(needed, 1024));
+    array = realloc(array, *capacity * element_size);
+    if (array == NULL) {
+        fail("out of memory");
+    }
+    return array;
+}
+
+static void *allocate(const size_t n, const size_t element_size) {
+    void *p = calloc(n + 1, element_size);
+    if (p == NULL) {
+        fail("out of memory");
+    }
+    return p;
+}
+
+/* Dump contents */
+
+typedef struct {
+    uint64_t address;
+    uint64_t size;
+    uint64_t first_ref;
+    uint32_t refs;
+    uint32_t group;
+} object;
+
+typedef struct {
+    uint32_t region;
+    uint64_t slot;
+    uint64_t address;
+} root;
+
+static object *objects = NULL;
+static size_t objects_number = 0, objects_capacity = 0;
+static uint64_t *refs = NULL; // referenced addresses of all objects, see first_ref
+static size_t refs_number = 0, refs_capacity = 0;
+static root *roots = NULL;
+static size_t roots_number = 0, roots_capacity = 0;
+static char **region_names = NULL;
+static size_t region_names_capacity = 0;
+
+// objects are grouped by constructor tag, strings, arrays and closures form groups of their own
+typedef struct {
+    uint64_t tag;
+    char *name;
+    uint64_t objects;
+    uint64_t shallow;
+    uint64_t retained;
+} group;
+
+static group *groups = NULL;
+static size_t groups_number = 0, groups_capacity = 0;
+
+static uint32_t add_group(const uint64_t tag, char *name) {
+    groups = grow(groups, &groups_capacity, groups_number + 1, sizeof(group));
+    groups[groups_number] = (group) {.tag = tag, .name = name};
+    return (uint32_t) groups_number++;
+}
+
+static uint32_t tag_group(const uint64_t tag) {
+    for (size_t i = 0; i < groups_number; i++) {
+        if (groups[i].tag == tag) {
+            return (uint32_t) i;
+        }
+    }
+    fail("tag %llu is used before its definition", (unsigned long long) tag);
+    return 0;
+}
+
+/* Reading */
+
+static FILE *in;
+
+static uint64_t get_number(void) {
+    uint64_t x = 0;
+    int shift = 0, c;
+    do {
+        if ((c = getc(in)) == EOF) {
+            fail("unexpected end of dump");
+        }
+        x |= (uint64_t) (c & 0x7F) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    return x;
+}
+
+static char *get_name(void) {
+    const uint64_t length = get_number();
+    char *name = allocate(length, 1);
+    if (fread(name, 1, length, in) != length) {
+        fail("unexpected end of dump");
+    }
+    return name;
+}
+
+static void read_dump(const char *path) {
+    if ((in = fopen(path, "rb")) == NULL) {
+        fail("can not open %s", path);
+    }
+    setvbuf(in, NULL, _IOFBF, 1 << 20);
+    char magic[sizeof(HEAP_DUMP_MAGIC)] = {0};
+    if (fread(magic, 1, strlen(HEAP_DUMP_MAGIC), in) != strlen(HEAP_DUMP_MAGIC) || strcmp(magic, HEAP_DUMP_MAGIC) != 0) {
+        fail("%s is not a heap dump", path);
+    }
+    add_group(0, "string");
+    add_group(0, "array");
+    add_group(0, "closure");
+
+    for (;;) {
+        const int kind = getc(in);
+        switch (kind) {
+            case HEAP_DUMP_END:
+                fclose(in);
+                return;
+            case HEAP_DUMP_REGION: {
+                const uint64_t index = get_number();
+                region_names = grow(region_names, &region_names_capacity, index + 1, sizeof(char *));
+                region_names[index] = get_name();
+                break;
+            }
+            case HEAP_DUMP_TAG: {
+                const uint64_t tag = get_number();
+                add_group(tag, get_name());
+                break;
+            }
+            case HEAP_DUMP_OBJECT: {
+                objects = grow(objects, &objects_capacity, objects_number + 1, sizeof(object));
+                object *o = &objects[objects_number++];
+                o->address = get_number();
+                const uint64_t type = get_number(), tag = get_number();
+                get_number(); // length
+                o->size = get_number();
+                o->refs = (uint32_t) get_number();
+                o->first_ref = refs_number;
+                o->group = type == STRING ? 0 : type == ARRAY ? 1 : type == CLOSURE ? 2 : tag_group(tag);
+                refs = grow(refs, &refs_capacity, refs_number + o->refs, sizeof(uint64_t));
+                for (uint32_t i = 0; i < o->refs; i++) {
+                    refs[refs_number++] = get_number();
+                }
+                break;
+            }
+            case HEAP_DUMP_ROOT: {
+                roots = grow(roots, &roots_capacity, roots_number + 1, sizeof(root));
+                root *r = &roots[roots_number++];
+                r->region = (uint32_t) get_number();
+                r->slot = get_number();
+                r->address = get_number();
+                break;
+            }
+            default:
+                fail("unknown record %d in dump", kind);
+        }
+    }
+}
+
+/* Graph: node 0 is the virtual root, nodes 1..roots_number are root slots, objects follow */
+
+static size_t nodes_number;
+static uint32_t *successors_start, *successors;
+static uint32_t *predecessors_start, *predecessors;
+static uint32_t *by_address; // objects sorted by address
+
+static int compare_by_address(const void *a, const void *b) {
+    const uint64_t x = objects[*(const uint32_t *) a].address, y = objects[*(const uint32_t *) b].address;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static uint32_t object_node(const uint64_t address) {
+    size_t lo = 0, hi = objects_number;
+    while (lo < hi) {
+        const size_t mid = (lo + hi) / 2;
+        if (objects[by_address[mid]].address < address) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == objects_number || objects[by_address[lo]].address != address) {
+        return NONE;
+    }
+    return (uint32_t) (1 + roots_number + by_address[lo]);
+}
+
+static void build_graph(void) {
+    nodes_number = 1 + roots_number + objects_number;
+    if (nodes_number >= NONE) {
+        fail("too many objects");
+    }
+    by_address = allocate(objects_number, sizeof(uint32_t));
+    for (size_t i = 0; i < objects_number; i++) {
+        by_address[i] = (uint32_t) i;
+    }
+    qsort(by_address, objects_number, sizeof(uint32_t), compare_by_address);
+
+    // edges are added in two passes: counting, then filling
+    successors_start = allocate(nodes_number + 1, sizeof(uint32_t));
+    predecessors_start = allocate(nodes_number + 1, sizeof(uint32_t));
+    uint32_t *fill = allocate(nodes_number, sizeof(uint32_t));
+    for (int pass = 0; pass < 2; pass++) {
+        size_t edges = 0;
+#define EDGE(from, to)                                                                  \
+        do {                                                                            \
+            const uint32_t f = (from), t = (to);                                        \
+            if (t == NONE) break;                                                       \
+            if (pass == 0) {                                                            \
+                successors_start[f + 1]++;                                              \
+                predecessors_start[t + 1]++;                                            \
+            } else {                                                                    \
+                successors[successors_start[f] + fill[f]++] = t;                        \
+                predecessors[predecessors_start[t + 1]++] = f;                          \
+            }                                                                           \
+            edges++;                                                                    \
+        } while (0)
+        for (size_t r = 0; r < roots_number; r++) {
+            EDGE(0, 1 + r);
+            EDGE(1 + r, object_node(roots[r].address));
+        }
+        for (size_t i = 0; i < objects_number; i++) {
+            for (uint32_t k = 0; k < objects[i].refs; k++) {
+                EDGE(1 + roots_number + i, object_node(refs[objects[i].first_ref + k]));
+            }
+        }
+#undef EDGE
+        if (pass == 0) {
+            for (size_t v = 0; v < nodes_number; v++) {
+                successors_start[v + 1] += successors_start[v];
+                predecessors_start[v + 1] += predecessors_start[v];
+            }
+            successors = allocate(edges, sizeof(uint32_t));
+            predecessors = allocate(edges, sizeof(uint32_t));
+            // predecessors_start[t + 1] is used as the fill cursor of t and ends as its end
+            memmove(predecessors_start + 1, predecessors_start, nodes_number * sizeof(uint32_t));
+        }
+    }
+    free(fill);
+    free(refs);
+}
+
+/* Lengauer-Tarjan with path compression */
+
+static uint32_t *dfnum, *vertex, *parent, *semi, *idom, *ancestor, *label, *work;
+static size_t reachable_number;
+
+static void depth_first_numbering(void) {
+    uint32_t *cursor = work; // next successor to visit, per node
+    uint32_t *stack = allocate(nodes_number, sizeof(uint32_t));
+    size_t top = 0, n = 0;
+    stack[top++] = 0;
+    dfnum[0] = ++n;
+    vertex[n] = 0;
+    cursor[0] = successors_start[0];
+    while (top > 0) {
+        const uint32_t v = stack[top - 1];
+        if (cursor[v] == successors_start[v + 1]) {
+            top--;
+            continue;
+        }
+        const uint32_t w = successors[cursor[v]++];
+        if (dfnum[w] == 0) {
+            dfnum[w] = ++n;
+            vertex[n] = w;
+            parent[w] = v;
+            cursor[w] = successors_start[w];
+            stack[top++] = w;
+        }
+    }
+    reachable_number = n;
+    free(stack);
+}
+
+static void compress(const uint32_t v) {
+    uint32_t *path = work;
+    size_t top = 0;
+    for (uint32_t u = v; ancestor[ancestor[u]] != NONE; u = ancestor[u]) {
+        path[top++] = u;
+    }
+    while (top > 0) {
+        const uint32_t x = path[--top];
+        if (semi[label[ancestor[x]]] < semi[label[x]]) {
+            label[x] = label[ancestor[x]];
+        }
+        ancestor[x] = ancestor[ancestor[x]];
+    }
+}
+
+static uint32_t eval(const uint32_t v) {
+    if (ancestor[v] == NONE) {
+        return v;
+    }
+    compress(v);
+    return label[v];
+}
+
+static void compute_dominators(void) {
+    dfnum = allocate(nodes_number, sizeof(uint32_t));
+    vertex = allocate(nodes_number + 1, sizeof(uint32_t));
+    parent = allocate(nodes_number, sizeof(uint32_t));
+    semi = allocate(nodes_number, sizeof(uint32_t));
+    idom = allocate(nodes_number, sizeof(uint32_t));
+    ancestor = allocate(nodes_number, sizeof(uint32_t));
+    label = allocate(nodes_number, sizeof(uint32_t));
+    work = allocate(nodes_number, sizeof(uint32_t));
+    uint32_t *bucket_head = allocate(nodes_number, sizeof(uint32_t));
+    uint32_t *bucket_next = allocate(nodes_number, sizeof(uint32_t));
+
+    depth_first_numbering();
+    for (size_t v = 0; v < nodes_number; v++) {
+        semi[v] = dfnum[v];
+        ancestor[v] = NONE;
+        label[v] = (uint32_t) v;
+        bucket_head[v] = NONE;
+        idom[v] = NONE;
+    }
+    for (size_t i = reachable_number; i >= 2; i--) {
+        const uint32_t w = vertex[i];
+        for (uint32_t k = predecessors_start[w]; k < predecessors_start[w + 1]; k++) {
+            const uint32_t v = predecessors[k];
+            if (dfnum[v] == 0) {
+                continue;
+            }
+            const uint32_t u = eval(v);
+            if (semi[u] < semi[w]) {
+                semi[w] = semi[u];
+            }
+        }
+        const uint32_t s = vertex[semi[w]];
+        bucket_next[w] = bucket_head[s];
+        bucket_head[s] = w;
+        ancestor[w] = parent[w];
+
+        const uint32_t p = parent[w];
+        for (uint32_t v = bucket_head[p]; v != NONE; v = bucket_next[v]) {
+            const uint32_t u = eval(v);
+            idom[v] = semi[u] < semi[v] ? u : p;
+        }
+        bucket_head[p] = NONE;
+    }
+    for (size_t i = 2; i <= reachable_number; i++) {
+        const uint32_t w = vertex[i];
+        if (idom[w] != vertex[semi[w]]) {
+            idom[w] = idom[idom[w]];
+        }
+    }
+    free(bucket_head);
+    free(bucket_next);
+}
+
+/* Retained sizes */
+
+static uint64_t *retained;
+
+static uint64_t node_size(const size_t v) {
+    return v > roots_number ? objects[v - 1 - roots_number].size : 0;
+}
+
+static void compute_retained_sizes(void) {
+    retained = allocate(nodes_number, sizeof(uint64_t));
+    for (size_t v = 0; v < nodes_number; v++) {
+        retained[v] = node_size(v);
+    }
+    // children come after their dominator in depth-first order
+    for (size_t i = reachable_number; i >= 2; i--) {
+        retained[idom[vertex[i]]] += retained[vertex[i]];
+    }
+
+    // an object is counted for its group unless one of its dominators is in the same group
+    uint32_t *children_start = allocate(nodes_number + 1, sizeof(uint32_t));
+    uint32_t *children = allocate(nodes_number, sizeof(uint32_t));
+    memset(work, 0, nodes_number * sizeof(uint32_t));
+    for (size_t i = 2; i <= reachable_number; i++) {
+        children_start[idom[vertex[i]] + 1]++;
+    }
+    for (size_t v = 0; v < nodes_number; v++) {
+        children_start[v + 1] += children_start[v];
+    }
+    for (size_t i = 2; i <= reachable_number; i++) {
+        const uint32_t d = idom[vertex[i]];
+        children[children_start[d] + work[d]++] = vertex[i];
+    }
+    uint32_t *active = allocate(groups_number, sizeof(uint32_t));
+    uint32_t *cursor = work;
+    uint32_t *stack = label;
+    size_t top = 0;
+    memset(cursor, 0, nodes_number * sizeof(uint32_t));
+    stack[top++] = 0;
+    while (top > 0) {
+        const uint32_t v = stack[top - 1];
+        const bool is_object = v > roots_number;
+        const uint32_t g = is_object ? objects[v - 1 - roots_number].group : 0;
+        if (cursor[v] == 0 && is_object && active[g]++ == 0) {
+            groups[g].retained += retained[v];
+        }
+        if (children_start[v] + cursor[v] == children_start[v + 1]) {
+            if (is_object) {
+                active[g]--;
+            }
+            top--;
+            continue;
+        }
+        stack[top++] = children[children_start[v] + cursor[v]++];
+    }
+    free(active);
+    free(children_start);
+    free(children);
+}
+
+/* Reports */
+
+static int compare_groups(const void *a, const void *b) {
+    const uint64_t x = ((const group *) a)->retained, y = ((const group *) b)->retained;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static int compare_roots(const void *a, const void *b) {
+    const uint64_t x = retained[1 + *(const uint32_t *) a], y = retained[1 + *(const uint32_t *) b];
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static void report(const size_t top_roots) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < objects_number; i++) {
+        groups[objects[i].group].objects++;
+        groups[objects[i].group].shallow += objects[i].size;
+        total += objects[i].size;
+    }
+    printf("Heap dump: %zu objects, %llu bytes, %zu roots, %zu objects are not reachable from the roots\n",
+           objects_number, (unsigned long long) total, roots_number,
+           objects_number + roots_number + 1 - reachable_number);
+
+    // roots are sorted before groups, as the latter changes group indices
+    uint32_t *order = allocate(roots_number, sizeof(uint32_t));
+    for (size_t r = 0; r < roots_number; r++) {
+        order[r] = (uint32_t) r;
+    }
+    qsort(order, roots_number, sizeof(uint32_t), compare_roots);
+    printf("\nRoots retaining the most:\n%14s  %-20s %s\n", "retained", "root", "object");
+    for (size_t i = 0; i < roots_number && i < top_roots; i++) {
+        const root *r = &roots[order[i]];
+        const uint32_t target = object_node(r->address);
+        char name[64];
+        snprintf(name, sizeof(name), "%s[%llu]", region_names[r->region], (unsigned long long) r->slot);
+        printf("%14llu  %-20s 0x%llx %s\n", (unsigned long long) retained[1 + order[i]], name,
+               (unsigned long long) r->address,
+               target == NONE ? "?" : groups[objects[target - 1 - roots_number].group].name);
+    }
+    free(order);
+
+    qsort(groups, groups_number, sizeof(group), compare_groups);
+    printf("\nRetained size per constructor tag:\n%14s %14s %12s  %s\n", "retained", "shallow", "objects", "tag");
+    for (size_t g = 0; g < groups_number; g++) {
+        if (groups[g].objects > 0) {
+            printf("%14llu %14llu %12llu  %s\n", (unsigned long long) groups[g].retained,
+                   (unsigned long long) groups[g].shallow, (unsigned long long) groups[g].objects, groups[g].name);
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fail("usage: %s <dump> [number of roots to report]", argv[0]);
+    }
+    read_dump(argv[1]);
+    build_graph();
+    compute_dominators();
+    compute_retained_sizes();
+    report(argc > 2 ? (size_t) strtoul(argv[2], NULL, 10) : 20);
+    return 0;
+}
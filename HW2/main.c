@@ -20,6 +20,10 @@ typedef struct {
 
 OperandStack g_stack = {.ebp_index = 0};
 
+// global variables, registered with GC as a root region
+static aint *globals = NULL;
+static size_t globals_number = 0;
+
 
 static inline aint *SP_ptr(void) {
     return (aint *) ((char *) __gc_stack_top + sizeof(size_t));
@@ -61,6 +65,7 @@ typedef enum OpGroup {
     OP_CTRL = 5,
     OP_PATT = 6,
     OP_RT = 7,
+    OP_QUICK = 8, // specialised variants written by the interpreter itself, see QUICKEN
     OP_END = 15
 };
 
@@ -123,7 +128,14 @@ typedef enum LowOp {
     RT_WRITE = 1,
     RT_LENGTH = 2,
     RT_STRING = 3,
-    RT_BARRAY = 4
+    RT_BARRAY = 4,
+
+    QUICK_ELEM = 0, // ELEM which has seen different containers, it is not specialised again
+    QUICK_ELEM_ARRAY = 1,
+    QUICK_ELEM_SEXP = 2,
+    QUICK_ELEM_STRING = 3,
+    QUICK_LD_C = 4,
+    QUICK_CALLC = 5 // the operand is the index of the inline cache, see callc_cache
 };
 
 static void operand_push(aint value, const ValueType type) {
@@ -177,24 +189,24 @@ static void operand_set(const size_t k, aint value, const ValueType type) {
 }
 
 static void store_global(const size_t k) {
-    if (k >= STACK_SIZE) {
-        failure("global index out of bounds: %d (size=%d)\n", k, STACK_SIZE);
+    if (k >= globals_number) {
+        failure("global index out of bounds: %zu (size=%zu)\n", k, globals_number);
     }
     const aint v = operand_top(UNKNOWN);
-    operand_set(STACK_SIZE - 1 - k, v, UNKNOWN);
+    gc_write_barrier((void *) globals[k], (void *) v);
+    globals[k] = v;
 }
 
 static void load_global(const size_t k) {
-    if (k >= STACK_SIZE) {
-        failure("global index out of bounds: %d (size=%d)\n", k, STACK_SIZE);
+    if (k >= globals_number) {
+        failure("global index out of bounds: %zu (size=%zu)\n", k, globals_number);
     }
-    const aint v = operand_get(STACK_SIZE - 1 - k, UNKNOWN);
-    operand_push(v, UNKNOWN);
+    operand_push(globals[k], UNKNOWN);
 }
 
 static aint get_closure_pointer() {
     aint closure_pointer = operand_get(g_stack.ebp_index + 2, POINTER);
-    if (TAG(TO_DATA(closure_pointer)->data_header) != CLOSURE_TAG) {
+    if (UNBOXED(closure_pointer) || TAG(TO_DATA(closure_pointer)->data_header) != CLOSURE_TAG) {
         failure("Expected closure\n");
     }
     return closure_pointer;
@@ -204,29 +216,51 @@ static void load_closure(const size_t k) {
     const aint closure_pointer = get_closure_pointer();
     const data *closure_data = TO_DATA(closure_pointer);
     if (TAG(closure_data->data_header) != CLOSURE_TAG) {
-        failure("Expected closure in store_closure\n");
+        failure("Expected closure in load_closure\n");
     }
-    const aint len = LEN(closure_data->data_header);
-    if (k >= len) {
-        failure("closure index out of bounds: %zu (len=%zu)\n", k, len);
+    // the first field is the code pointer
+    const aint captured = LEN(closure_data->data_header) - 1;
+    if (k >= captured) {
+        failure("closure index out of bounds: %zu (captured=%zu)\n", k, captured);
     }
-    const aint res = ((aint *) closure_data->contents)[k + 1];
+    const aint res = field_load(&FIELDS(closure_data->contents)[k + 1]);
     operand_push(res, UNKNOWN);
 }
 
 
+// LD C after the first execution: the closure is checked once, with a single guard
+static void load_closure_quick(const int k) {
+    const aint closure_pointer = g_stack.ebp_index + 2 < STACK_SIZE
+                                     ? g_stack.operand_stack[g_stack.ebp_index + 2]
+                                     : BOX(0);
+    if (UNBOXED(closure_pointer)) {
+        load_closure(k);
+        return;
+    }
+    const data *closure_data = TO_DATA(closure_pointer);
+    if (TAG(closure_data->data_header) != CLOSURE_TAG || (size_t) k + 1 >= LEN(closure_data->data_header)) {
+        // reports the error
+        load_closure(k);
+        return;
+    }
+    operand_push(field_load(&FIELDS(closure_data->contents)[k + 1]), UNKNOWN);
+}
+
 static void store_closure(const size_t k) {
     const aint closure_pointer = get_closure_pointer();
     const data *closure_data = TO_DATA(closure_pointer);
     if (TAG(closure_data->data_header) != CLOSURE_TAG) {
         failure("Expected closure in store_closure\n");
     }
-    const aint len = LEN(closure_data->data_header);
-    if (k >= len) {
-        failure("closure index out of bounds: %zu (len=%zu)\n", k, len);
+    // the first field is the code pointer
+    const aint captured = LEN(closure_data->data_header) - 1;
+    if (k >= captured) {
+        failure("closure index out of bounds: %zu (captured=%zu)\n", k, captured);
     }
     const aint v = operand_top(UNKNOWN);
-    ((aint *) closure_data->contents)[k + 1] = v;
+    field_t *field = &FIELDS(closure_data->contents)[k + 1];
+    gc_write_barrier((void *) field_load(field), (void *) v);
+    field_store(field, v);
 }
 
 static size_t get_local_pos(const size_t k) {
@@ -337,6 +371,15 @@ static void reverse_last_el(const int el_count) {
     }
 }
 
+// fields[i] = SP[n - 1 - i]: the first field is the deepest operand
+static aint fill_fields(data *obj, const aint *SP, const int first, const int n) {
+    field_t *fields = FIELDS(obj->contents);
+    for (int i = 0; i < n; ++i) {
+        field_store(&fields[first + i], SP[n - 1 - i]);
+    }
+    return (aint) obj->contents;
+}
+
 static void barray_function(const int n) {
     if (n < 0) {
         failure("Barray: invalid size %d\n", n);
@@ -344,22 +387,117 @@ static void barray_function(const int n) {
 
     aint *SP = SP_ptr();
 
-    const aint arr = (aint) Barray(SP, BOX(n));
+    data *obj = gc_alloc_fields_inline(ARRAY_TAG | ((auint) n << 3), n);
+    const aint arr = obj != NULL ? fill_fields(obj, SP, 0, n) : (aint) Barray(SP, BOX(n));
     gc_stack_offset(n);
     operand_push(arr, POINTER);
 }
 
+/* S-expressions without fields and closures without captured values are immutable and
+   have no references, so all evaluations share one permanent object (see alloc_permanent)
+   per tag or per code address; they are created on the first evaluation */
+static aint *shared_sexps = NULL;           // by tag index, 0 if not created
+static size_t shared_sexps_capacity = 0;
+static aint *shared_closures = NULL;        // by code offset, 0 if not created
+static size_t code_size = 0;
+
+// returns 0 if the object can't be shared
+static aint shared_sexp(const aint hash_tag) {
+    const auint index = sexp_tag_index(hash_tag);
+    if (index >= shared_sexps_capacity) {
+        const size_t capacity = MAX(2 * shared_sexps_capacity, index + 1);
+        shared_sexps = realloc(shared_sexps, capacity * sizeof(aint));
+        if (shared_sexps == NULL) {
+            failure("Out of memory for shared s-expressions\n");
+        }
+        memset(shared_sexps + shared_sexps_capacity, 0, (capacity - shared_sexps_capacity) * sizeof(aint));
+        shared_sexps_capacity = capacity;
+    }
+    if (shared_sexps[index] == 0) {
+        data *obj = alloc_permanent(sexp_size(0));
+        if (obj == NULL) {
+            return 0;
+        }
+        obj->data_header = SEXP_HEADER(0, index);
+        shared_sexps[index] = (aint) obj->contents;
+    }
+    return shared_sexps[index];
+}
+
+// returns 0 if the object can't be shared
+static aint shared_closure(const int code_pointer) {
+    if (code_pointer < 0 || (size_t) code_pointer >= code_size) {
+        return 0;
+    }
+    if (shared_closures == NULL) {
+        shared_closures = calloc(code_size, sizeof(aint));
+        if (shared_closures == NULL) {
+            failure("Out of memory for shared closures\n");
+        }
+    }
+    if (shared_closures[code_pointer] == 0) {
+        data *obj = alloc_permanent(closure_size(1));
+        if (obj == NULL) {
+            return 0;
+        }
+        obj->data_header = CLOSURE_TAG | (1 << 3);
+        FIELDS(obj->contents)[0] = (field_t) code_pointer;
+        shared_closures[code_pointer] = (aint) obj->contents;
+    }
+    return shared_closures[code_pointer];
+}
+
 static void sexp_function(char *tag, const int elem_size) {
     const aint hash_tag = UNBOX(LtagHash(tag));
+    if (elem_size == 0) {
+        const aint shared = shared_sexp(hash_tag);
+        if (shared != 0) {
+            operand_push(shared, POINTER);
+            return;
+        }
+    }
+    aint *SP = SP_ptr();
+    if (elem_size == 2 && hash_tag == CONS_SEXP_TAG) {
+        // cons cells have a kind of their own, the tag is not needed
+        data *obj = gc_alloc_fields_inline(CONS_HEADER, 2);
+        const aint result = obj != NULL ? fill_fields(obj, SP, 0, 2) : (aint) Bcons(SP);
+        gc_stack_offset(2);
+        operand_push(result, POINTER);
+        return;
+    }
+
+    data *obj = gc_alloc_fields_inline(SEXP_HEADER(elem_size, sexp_tag_index(hash_tag)), elem_size);
+    if (obj != NULL) {
+        const aint result = fill_fields(obj, SP, 0, elem_size);
+        gc_stack_offset(elem_size);
+        operand_push(result, POINTER);
+        return;
+    }
     operand_push(hash_tag, VAL);
 
-    aint *SP = SP_ptr();
+    SP = SP_ptr();
     const aint result = (aint) Bsexp(SP, BOX(elem_size + 1));
     gc_stack_offset(elem_size + 1);
     operand_push(result, POINTER);
 }
 
 static void closure_function(const int code_pointer, const int arg_number) {
+    if (arg_number == 0) {
+        const aint shared = shared_closure(code_pointer);
+        if (shared != 0) {
+            operand_push(shared, POINTER);
+            return;
+        }
+    }
+    data *obj = gc_alloc_fields_inline(CLOSURE_TAG | ((auint) (arg_number + 1) << 3), arg_number + 1);
+    if (obj != NULL) {
+        // the code pointer is not a Lama value, so it is stored as it is
+        FIELDS(obj->contents)[0] = (field_t) code_pointer;
+        const aint closure = fill_fields(obj, SP_ptr(), 1, arg_number);
+        gc_stack_offset(arg_number);
+        operand_push(closure, POINTER);
+        return;
+    }
     operand_push(code_pointer, POINTER);
     aint *SP = SP_ptr();
     aint *closure = Bclosure(SP, BOX(arg_number));
@@ -369,28 +507,38 @@ static void closure_function(const int code_pointer, const int arg_number) {
 }
 
 
+// the ELEM variant for the container, QUICK_ELEM if there is no specialised one
+static inline int elem_variant(const aint container) {
+    if (UNBOXED(container)) {
+        return QUICK_ELEM;
+    }
+    switch (KIND(TO_DATA(container)->data_header)) {
+        case ARRAY_TAG:
+            return QUICK_ELEM_ARRAY;
+        case SEXP_TAG:
+            return QUICK_ELEM_SEXP;
+        case STRING_TAG:
+            return QUICK_ELEM_STRING;
+        default:
+            return QUICK_ELEM;
+    }
+}
+
 static aint callc_function(const int arg_number) {
-    size_t closure_pos = stack_top_index() + (size_t) arg_number;
-    if (closure_pos >= STACK_SIZE)
+    if (arg_number < 0 || stack_top_index() + (size_t) arg_number >= STACK_SIZE)
         failure("CALLC: invalid stack layout\n");
 
-    aint closure_val = operand_get(closure_pos, POINTER);
-    data *closure_data = TO_DATA(closure_val);
-
-    for (int i = arg_number - 1; i >= 0; --i) {
-        size_t base = stack_top_index();
-        operand_set(base + (size_t) i + 1,
-                    operand_get(base + (size_t) i, UNKNOWN),
-                    UNKNOWN);
-    }
-    operand_set(stack_top_index(), closure_val, POINTER);
-    const aint code_pointer = ((aint *) closure_data->contents)[0];
-    if (TAG(closure_data->data_header) != CLOSURE_TAG) {
+    // the arguments are moved up, the closure goes below them
+    aint *SP = SP_ptr();
+    const aint closure_val = SP[arg_number];
+    if (UNBOXED(closure_val) || TAG(TO_DATA(closure_val)->data_header) != CLOSURE_TAG) {
         failure("Expected closure\n");
     }
-
-
-    return code_pointer;
+    for (int i = arg_number; i > 0; --i) {
+        SP[i] = SP[i - 1];
+    }
+    SP[0] = closure_val;
+    return FIELDS(TO_DATA(closure_val)->contents)[0];
 }
 
 /* The unpacked representation of bytecode file */
@@ -489,6 +637,757 @@ bytefile *read_file(char *fname) {
     return file;
 }
 
+/* For every offset of the string table, the length of the string which starts there:
+   STRING copies a literal without strlen */
+static uint32_t *literal_lengths = NULL;
+
+static void compute_literal_lengths(const bytefile *bf) {
+    literal_lengths = malloc((bf->stringtab_size + 1) * sizeof(uint32_t));
+    if (literal_lengths == NULL) {
+        failure("*** FAILURE: unable to allocate memory.\n");
+    }
+    literal_lengths[bf->stringtab_size] = 0;
+    for (int i = bf->stringtab_size - 1; i >= 0; i--) {
+        literal_lengths[i] = bf->string_ptr[i] == 0 ? 0 : literal_lengths[i + 1] + 1;
+    }
+}
+
+/* Stack maps.
+   For every point where GC may happen in a frame (right after an allocating
+   instruction or a call) the set of locals which are still read afterwards is
+   computed by a backward liveness analysis over the control flow of each
+   function. GC scans only live locals of every frame (see live_stack_slots),
+   so values which are never used again do not keep garbage alive. A point is
+   keyed by the offset where execution resumes: for a caller frame it is the
+   return address saved in its callee's frame, for the top frame 'safepoint_ip'. */
+
+// resume point of the top frame while it executes an instruction which may trigger GC
+static char *safepoint_ip = NULL;
+
+static struct {
+    const char *code;
+    uint32_t *index;  // code offset -> 1 + position of the point in 'words', 0 if there is no point
+    uint64_t *words;  // for every point: the number of locals, then the bitset of live ones
+    size_t words_size;
+    size_t words_capacity;
+} stack_maps;
+
+enum {
+    INSN_NEXT = 1,      // execution may continue with the next instruction
+    INSN_JUMP = 2,      // execution may continue at 'target'
+    INSN_SAFEPOINT = 4, // GC may happen while the instruction is executed
+    INSN_BEGIN = 8      // function entry with 'locals' locals
+};
+
+typedef struct {
+    int length;
+    int flags;
+    int target;
+    int locals;
+} insn_info;
+
+#define SET_WORDS(n) (((size_t) (n) + 63) / 64)
+
+static void add_local(uint64_t *set, const int locals, const int k) {
+    if (set != NULL && k >= 0 && k < locals) {
+        set[k / 64] |= (uint64_t) 1 << (k % 64);
+    }
+}
+
+// returns the first local in [from, to) which is in 'set' if 'live' and is not otherwise, 'to' if there is none
+static aint next_local(const uint64_t *set, aint from, const aint to, const bool live) {
+    while (from < to) {
+        const uint64_t word = (live ? set[from / 64] : ~set[from / 64]) >> (from % 64);
+        if (word != 0) {
+            return MIN(from + __builtin_ctzll(word), to);
+        }
+        from = (from / 64 + 1) * 64;
+    }
+    return to;
+}
+
+/* Decodes the instruction at 'offset', adds locals it reads to 'use' and the one it
+   writes to 'def' (both may be NULL). Returns false if the instruction can not be
+   decoded or is not supported by stack maps */
+static bool decode_insn(const bytefile *bf, const int offset, const int locals,
+                        uint64_t *use, uint64_t *def, insn_info *info) {
+    const char *code = bf->code_ptr;
+    const int size = (int) (bf->code_end - bf->code_ptr);
+    int p = offset;
+
+#define NEED(n) do { if (p + (n) > size) return false; } while (0)
+#define ARG (p += sizeof(int), *(const int *) (code + p - sizeof(int)))
+    NEED(1);
+    const unsigned char x = code[p++];
+    const int h = (x & 0xF0) >> 4, l = x & 0x0F;
+
+    info->flags = INSN_NEXT;
+    switch (h) {
+        case OP_BINOP:
+        case OP_PATT:
+            break;
+        case OP_MISC:
+            switch (l) {
+                case MI_CONST:
+                    NEED(4); ARG;
+                    break;
+                case MI_STRING:
+                    NEED(4); ARG;
+                    info->flags |= INSN_SAFEPOINT;
+                    break;
+                case MI_SEXP:
+                    NEED(8); ARG; ARG;
+                    info->flags |= INSN_SAFEPOINT;
+                    break;
+                case MI_JMP:
+                    NEED(4);
+                    info->target = ARG;
+                    info->flags = INSN_JUMP;
+                    break;
+                case MI_END:
+                    info->flags = 0;
+                    break;
+                case MI_STI: case MI_STA: case MI_RET: case MI_DROP: case MI_DUP: case MI_SWAP: case MI_ELEM:
+                    break;
+                default:
+                    return false;
+            }
+            break;
+        case OP_LD:
+        case OP_ST:
+            NEED(4);
+            const int k = ARG;
+            if (l == LDS_L) {
+                add_local(h == OP_LD ? use : def, locals, k);
+            } else if (l > LDS_C) {
+                return false;
+            }
+            break;
+        case OP_CTRL:
+            switch (l) {
+                case CTRL_CJMPZ:
+                case CTRL_CJMPNZ:
+                    NEED(4);
+                    info->target = ARG;
+                    info->flags |= INSN_JUMP;
+                    break;
+                case CTRL_BEGIN:
+                case CTRL_CBEGIN:
+                    NEED(8); ARG;
+                    info->locals = ARG;
+                    info->flags |= INSN_BEGIN;
+                    break;
+                case CTRL_CLOSURE: {
+                    NEED(8); ARG;
+                    const int n = ARG;
+                    for (int i = 0; i < n; i++) {
+                        NEED(5);
+                        const int kind = code[p++];
+                        const int pos = ARG;
+                        if (kind == LDS_L) {
+                            add_local(use, locals, pos);
+                        } else if (kind > LDS_C) {
+                            return false;
+                        }
+                    }
+                    info->flags |= INSN_SAFEPOINT;
+                    break;
+                }
+                case CTRL_CALLC:
+                    NEED(4); ARG;
+                    info->flags |= INSN_SAFEPOINT;
+                    break;
+                case CTRL_CALL:
+                    NEED(8); ARG; ARG;
+                    info->flags |= INSN_SAFEPOINT;
+                    break;
+                case CTRL_TAG:
+                    NEED(8); ARG; ARG;
+                    break;
+                case CTRL_ARRAY:
+                case CTRL_LINE:
+                    NEED(4); ARG;
+                    break;
+                case CTRL_FAIL:
+                    NEED(8); ARG; ARG;
+                    info->flags = 0;
+                    break;
+                default:
+                    return false;
+            }
+            break;
+        case OP_RT:
+            switch (l) {
+                case RT_READ: case RT_WRITE: case RT_LENGTH:
+                    break;
+                case RT_STRING:
+                    info->flags |= INSN_SAFEPOINT;
+                    break;
+                case RT_BARRAY:
+                    NEED(4); ARG;
+                    info->flags |= INSN_SAFEPOINT;
+                    break;
+                default:
+                    return false;
+            }
+            break;
+        case OP_END:
+            info->flags = 0;
+            break;
+        default:
+            // including LDA: a local whose address is taken is never dead
+            return false;
+    }
+#undef NEED
+#undef ARG
+    info->length = p - offset;
+    return true;
+}
+
+static int compare_offsets(const void *a, const void *b) {
+    return *(const int *) a - *(const int *) b;
+}
+
+static void add_stack_map(const int resume, const int locals, const uint64_t *live) {
+    const size_t n = 1 + SET_WORDS(locals);
+    if (stack_maps.words_size + n > stack_maps.words_capacity) {
+        stack_maps.words_capacity = MAX(2 * stack_maps.words_capacity, stack_maps.words_size + n + 1024);
+        stack_maps.words = realloc(stack_maps.words, stack_maps.words_capacity * sizeof(uint64_t));
+        if (stack_maps.words == NULL) {
+            failure("*** FAILURE: unable to allocate memory.\n");
+        }
+    }
+    stack_maps.index[resume] = (uint32_t) stack_maps.words_size + 1;
+    stack_maps.words[stack_maps.words_size] = (uint64_t) locals;
+    memcpy(&stack_maps.words[stack_maps.words_size + 1], live, SET_WORDS(locals) * sizeof(uint64_t));
+    stack_maps.words_size += n;
+}
+
+/* Computes liveness of locals for the function which starts at 'entry'; 'owner' and
+   'position' map code offsets to the function they belong to and to the position in
+   its instruction list. Returns false if the control flow can not be analysed */
+static bool build_function_maps(const bytefile *bf, const int entry, const int locals, const char *is_start,
+                                int *owner, int *position, int **list, size_t *list_capacity) {
+    const int size = (int) (bf->code_end - bf->code_ptr);
+    if (owner[entry] != 0) {
+        return false;
+    }
+
+    // instructions reachable from the entry without calls
+    size_t n = 0, visited = 0;
+    owner[entry] = entry + 1;
+    (*list)[n++] = entry;
+    while (visited < n) {
+        insn_info info = {0};
+        const int offset = (*list)[visited++];
+        decode_insn(bf, offset, 0, NULL, NULL, &info);
+        const int successors[] = {
+            info.flags & INSN_NEXT ? offset + info.length : -1,
+            info.flags & INSN_JUMP ? info.target : -1
+        };
+        for (int s = 0; s < 2; s++) {
+            const int next = successors[s];
+            if (next == -1 || (next >= 0 && next < size && owner[next] == entry + 1)) {
+                continue;
+            }
+            // jumps out of the code and code shared between functions are not expected
+            if (next < 0 || next >= size || !is_start[next] || owner[next] != 0) {
+                return false;
+            }
+            if (n == *list_capacity) {
+                *list_capacity *= 2;
+                *list = realloc(*list, *list_capacity * sizeof(int));
+                if (*list == NULL) {
+                    failure("*** FAILURE: unable to allocate memory.\n");
+                }
+            }
+            owner[next] = entry + 1;
+            (*list)[n++] = next;
+        }
+    }
+    if (locals == 0) {
+        return true;
+    }
+
+    qsort(*list, n, sizeof(int), compare_offsets);
+    for (size_t i = 0; i < n; i++) {
+        position[(*list)[i]] = (int) i;
+    }
+
+    const size_t w = SET_WORDS(locals);
+    uint64_t *live_in = calloc(n * w + 3 * w, sizeof(uint64_t));
+    if (live_in == NULL) {
+        failure("*** FAILURE: unable to allocate memory.\n");
+    }
+    uint64_t *use = live_in + n * w, *def = use + w, *out = def + w;
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t i = n; i-- > 0;) {
+            insn_info info = {0};
+            memset(use, 0, 3 * w * sizeof(uint64_t));
+            decode_insn(bf, (*list)[i], locals, use, def, &info);
+            if (info.flags & INSN_NEXT) {
+                const uint64_t *s = &live_in[position[(*list)[i] + info.length] * w];
+                for (size_t j = 0; j < w; j++) out[j] |= s[j];
+            }
+            if (info.flags & INSN_JUMP) {
+                const uint64_t *s = &live_in[position[info.target] * w];
+                for (size_t j = 0; j < w; j++) out[j] |= s[j];
+            }
+            uint64_t *in = &live_in[i * w];
+            for (size_t j = 0; j < w; j++) {
+                const uint64_t v = use[j] | (out[j] & ~def[j]);
+                if (v != in[j]) {
+                    in[j] = v;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        insn_info info = {0};
+        decode_insn(bf, (*list)[i], 0, NULL, NULL, &info);
+        if ((info.flags & INSN_SAFEPOINT) && (info.flags & INSN_NEXT)) {
+            const int resume = (*list)[i] + info.length;
+            add_stack_map(resume, locals, &live_in[position[resume] * w]);
+        }
+    }
+    free(live_in);
+    return true;
+}
+
+/* Builds stack maps for the whole bytecode, returns false if it can not be analysed */
+static bool build_stack_maps(const bytefile *bf) {
+    const int size = (int) (bf->code_end - bf->code_ptr);
+    char *is_start = calloc(size + 1, 1);
+    int *owner = calloc(size + 1, sizeof(int));
+    int *position = calloc(size + 1, sizeof(int));
+    size_t list_capacity = 1024;
+    int *list = malloc(list_capacity * sizeof(int));
+    stack_maps.code = bf->code_ptr;
+    stack_maps.index = calloc(size + 1, sizeof(uint32_t));
+    if (is_start == NULL || owner == NULL || position == NULL || list == NULL || stack_maps.index == NULL) {
+        failure("*** FAILURE: unable to allocate memory.\n");
+    }
+
+    bool ok = true;
+    for (int p = 0; ok && p < size;) {
+        insn_info info = {0};
+        ok = decode_insn(bf, p, 0, NULL, NULL, &info);
+        is_start[p] = 1;
+        p += info.length;
+    }
+    for (int p = 0; ok && p < size; p++) {
+        insn_info info = {0};
+        if (is_start[p] && decode_insn(bf, p, 0, NULL, NULL, &info) && (info.flags & INSN_BEGIN)) {
+            ok = build_function_maps(bf, p, info.locals, is_start, owner, position, &list, &list_capacity);
+        }
+    }
+
+    free(is_start);
+    free(owner);
+    free(position);
+    free(list);
+    if (!ok) {
+        free(stack_maps.index);
+        free(stack_maps.words);
+        stack_maps.index = NULL;
+        stack_maps.words = NULL;
+    }
+    return ok;
+}
+
+/* Passes GC the slots of every frame which may hold live values: the closure and
+   the arguments, the locals live at the resume point and the operands pushed by
+   the frame. Frame bookkeeping and return addresses are skipped; dead locals are
+   skipped as well and cleared, since moving collectors would not update them */
+static void live_stack_slots(void (*add)(size_t *begin, size_t *end)) {
+    aint *const stack = g_stack.operand_stack;
+    // the lowest slot of the operands pushed by the frame
+    aint operands = (aint) stack_top_index();
+    aint ebp = g_stack.ebp_index;
+    const char *resume = safepoint_ip;
+    // no frame is active before the first BEGIN and after the last END
+    while (ebp != 0) {
+        const aint locals = UNBOX(stack[ebp - 2]);
+        const aint first_local = ebp - 2 - locals;
+        add((size_t *) &stack[operands], (size_t *) &stack[first_local]);
+
+        const uint32_t point =
+                resume != NULL && stack_maps.index != NULL ? stack_maps.index[resume - stack_maps.code] : 0;
+        if (point != 0 && stack_maps.words[point - 1] == (uint64_t) locals) {
+            // local i is at ebp - 3 - i, so locals [a, b) take slots [ebp - 2 - b, ebp - 2 - a)
+            const uint64_t *live = &stack_maps.words[point];
+            for (aint a = 0; a < locals;) {
+                const aint b = next_local(live, a, locals, true);
+                for (aint *p = &stack[ebp - 2 - b]; p < &stack[ebp - 2 - a]; p++) {
+                    *p = BOX(0);
+                }
+                a = next_local(live, b, locals, false);
+                add((size_t *) &stack[ebp - 2 - a], (size_t *) &stack[ebp - 2 - b]);
+            }
+        } else {
+            add((size_t *) &stack[first_local], (size_t *) &stack[ebp - 2]);
+        }
+
+        // the closure and the arguments end where the caller's locals start
+        resume = (const char *) stack[ebp - 1];
+        const aint caller = resume != NULL ? UNBOX(stack[ebp]) : 0;
+        const aint limit = caller != 0 ? caller - 2 - UNBOX(stack[caller - 2]) : STACK_SIZE;
+        const aint args_end = MIN(ebp + 3 + UNBOX(stack[ebp + 1]), limit);
+        add((size_t *) &stack[ebp + 2], (size_t *) &stack[args_end]);
+        operands = args_end;
+        ebp = caller;
+    }
+    add((size_t *) &stack[operands], (size_t *) &stack[STACK_SIZE]);
+}
+
+/* Allocation profiler, enabled by LAMA_ALLOC_PROFILE=<period>.
+
+   Every object allocated by STRING, SEXP, CLOSURE, BARRAY and Lstring is counted
+   for the site (offset of the instruction) which has allocated it; one of 'period'
+   objects on average, at random intervals, is also sampled to see whether it survives
+   collections. Sampled objects are
+   not kept alive: with lisp2 collector, sliding compaction and stw mode GC calls
+   'gc_before_relocation', which drops dead samples and moves the rest to their new
+   locations, other configurations report no survival. At exit the sites are printed
+   to stderr with the nearest preceding public symbol and the line of the nearest
+   LINE preceding the site in its function. */
+
+typedef struct {
+    int offset;
+    int line;
+    size_t objects;
+    size_t bytes;
+    size_t sampled;
+    size_t survived;  // sampled objects which have survived at least one collection
+    size_t survivals; // collections survived by sampled objects
+} alloc_site;
+
+typedef struct {
+    void *obj;
+    uint32_t site;
+    bool survived;
+} alloc_sample;
+
+static struct {
+    bool enabled;
+    bool sample;
+    size_t period;
+    size_t countdown;
+    uint64_t rng; // xorshift64 state, never 0
+    const bytefile *bf;
+    uint32_t *index; // code offset -> 1 + position of the site in 'sites', 0 if nothing is allocated there
+    int *lines;      // code offset -> line of the instruction there, 0 if unknown
+    alloc_site *sites;
+    size_t sites_number;
+    size_t sites_capacity;
+    alloc_sample *samples;
+    size_t samples_number;
+    size_t samples_capacity;
+} alloc_profile;
+
+static void *grow_array(void *array, size_t *capacity, const size_t element_size) {
+    *capacity = MAX(2 * *capacity, 256);
+    array = realloc(array, *capacity * element_size);
+    if (array == NULL) {
+        failure("*** FAILURE: unable to allocate memory.\n");
+    }
+    return array;
+}
+
+/* Objects until the next sample: uniform in [1, 2 * period - 1], so the mean is the period
+   and sampling does not alias with periodic allocation patterns. The generator is seeded
+   by LAMA_ALLOC_PROFILE_SEED (or a fixed seed), so a run can be reproduced */
+static size_t next_sample_distance(void) {
+    uint64_t x = alloc_profile.rng;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    alloc_profile.rng = x;
+    return 1 + (size_t) (x % (2 * alloc_profile.period - 1));
+}
+
+/* Accounts the object on the top of the stack to the site of the instruction at 'insn' */
+static void profile_allocation(const char *insn) {
+    void *obj = (void *) operand_top(POINTER);
+    if (!is_valid_heap_pointer(obj)) {
+        // a shared object is not allocated
+        return;
+    }
+    const int offset = (int) (insn - alloc_profile.bf->code_ptr);
+    if (alloc_profile.index[offset] == 0) {
+        if (alloc_profile.sites_number == alloc_profile.sites_capacity) {
+            alloc_profile.sites = grow_array(alloc_profile.sites, &alloc_profile.sites_capacity, sizeof(alloc_site));
+        }
+        alloc_profile.sites[alloc_profile.sites_number] = (alloc_site) {.offset = offset, .line = alloc_profile.lines[offset]};
+        alloc_profile.index[offset] = (uint32_t) ++alloc_profile.sites_number;
+    }
+    const uint32_t site = alloc_profile.index[offset] - 1;
+    alloc_profile.sites[site].objects++;
+    alloc_profile.sites[site].bytes += obj_size_row_ptr(obj);
+
+    if (!alloc_profile.sample || --alloc_profile.countdown > 0) {
+        return;
+    }
+    alloc_profile.countdown = next_sample_distance();
+    if (alloc_profile.samples_number == alloc_profile.samples_capacity) {
+        alloc_profile.samples = grow_array(alloc_profile.samples, &alloc_profile.samples_capacity,
+                                           sizeof(alloc_sample));
+    }
+    alloc_profile.samples[alloc_profile.samples_number++] = (alloc_sample) {obj, site, false};
+    alloc_profile.sites[site].sampled++;
+}
+
+/* Called by GC between computing new locations of live objects and moving them */
+static void follow_alloc_samples(void) {
+    size_t n = 0;
+    for (size_t i = 0; i < alloc_profile.samples_number; i++) {
+        alloc_sample sample = alloc_profile.samples[i];
+        if (!is_marked(sample.obj)) {
+            continue;
+        }
+        alloc_site *site = &alloc_profile.sites[sample.site];
+        site->survivals++;
+        if (!sample.survived) {
+            site->survived++;
+            sample.survived = true;
+        }
+        // large objects are not moved; the header at the new location is not written yet,
+        // so the content is found by the offset from the old header
+        if (!los_contains(sample.obj)) {
+            const char *header = get_obj_header_ptr(sample.obj);
+            sample.obj = (char *) get_forward_address(sample.obj) + ((char *) sample.obj - header);
+        }
+        alloc_profile.samples[n++] = sample;
+    }
+    alloc_profile.samples_number = n;
+}
+
+static int compare_sites_by_bytes(const void *a, const void *b) {
+    const size_t x = ((const alloc_site *) a)->bytes, y = ((const alloc_site *) b)->bytes;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static void report_alloc_profile(void) {
+    const bytefile *bf = alloc_profile.bf;
+    qsort(alloc_profile.sites, alloc_profile.sites_number, sizeof(alloc_site), compare_sites_by_bytes);
+    size_t objects = 0, bytes = 0;
+    for (size_t i = 0; i < alloc_profile.sites_number; i++) {
+        objects += alloc_profile.sites[i].objects;
+        bytes += alloc_profile.sites[i].bytes;
+    }
+    fprintf(stderr, "Allocation profile: %zu objects, %zu bytes, 1 of %zu objects sampled on average\n", objects, bytes,
+            alloc_profile.period);
+    fprintf(stderr, "%14s %12s %9s %7s  %s\n", "bytes", "objects", "survived", "GCs", "site");
+    for (size_t i = 0; i < alloc_profile.sites_number; i++) {
+        const alloc_site *site = &alloc_profile.sites[i];
+        // the nearest public symbol at or before the site
+        int symbol = -1;
+        for (int j = 0; j < bf->public_symbols_number; j++) {
+            const int offset = get_public_offset((bytefile *) bf, j);
+            if (offset <= site->offset && (symbol < 0 || offset > get_public_offset((bytefile *) bf, symbol))) {
+                symbol = j;
+            }
+        }
+        fprintf(stderr, "%14zu %12zu ", site->bytes, site->objects);
+        if (site->sampled > 0) {
+            fprintf(stderr, "%8.1f%% %7.2f  ", 100.0 * site->survived / site->sampled,
+                    (double) site->survivals / site->sampled);
+        } else {
+            fprintf(stderr, "%9s %7s  ", "-", "-");
+        }
+        fprintf(stderr, "0x%.8x", site->offset);
+        if (symbol >= 0) {
+            fprintf(stderr, " %s+0x%x", get_public_name((bytefile *) bf, symbol),
+                    site->offset - get_public_offset((bytefile *) bf, symbol));
+        }
+        fprintf(stderr, " (line %d)\n", site->line);
+    }
+}
+
+/* Length of the instruction at offset p by its opcode, 0 if the opcode is invalid or the
+   instruction is truncated; unlike decode_insn it accepts every instruction */
+static size_t insn_length(const char *code, const size_t size, const size_t p) {
+    const unsigned char x = (unsigned char) code[p];
+    const int h = x >> 4, l = x & 0x0F;
+    size_t n = 0;
+    switch (h) {
+        case OP_BINOP:
+            n = l >= BINOP_ADD && l <= BINOP_OR ? 1 : 0;
+            break;
+        case OP_MISC:
+            switch (l) {
+                case MI_CONST: case MI_STRING: case MI_JMP:
+                    n = 5;
+                    break;
+                case MI_SEXP:
+                    n = 9;
+                    break;
+                case MI_STI: case MI_STA: case MI_END: case MI_RET: case MI_DROP: case MI_DUP: case MI_SWAP:
+                case MI_ELEM:
+                    n = 1;
+                    break;
+            }
+            break;
+        case OP_LD:
+        case OP_LDA:
+        case OP_ST:
+            n = l <= LDS_C ? 5 : 0;
+            break;
+        case OP_CTRL:
+            switch (l) {
+                case CTRL_CJMPZ: case CTRL_CJMPNZ: case CTRL_CALLC: case CTRL_ARRAY: case CTRL_LINE:
+                    n = 5;
+                    break;
+                case CTRL_BEGIN: case CTRL_CBEGIN: case CTRL_CALL: case CTRL_TAG: case CTRL_FAIL:
+                    n = 9;
+                    break;
+                case CTRL_CLOSURE: {
+                    int captured;
+                    if (p + 9 > size) {
+                        return 0;
+                    }
+                    memcpy(&captured, code + p + 5, sizeof(int));
+                    n = captured < 0 ? 0 : 9 + 5 * (size_t) captured;
+                    break;
+                }
+            }
+            break;
+        case OP_PATT:
+            n = l <= PATT_CLOSURE_TAG ? 1 : 0;
+            break;
+        case OP_RT:
+            n = l < RT_BARRAY ? 1 : l == RT_BARRAY ? 5 : 0;
+            break;
+        case OP_QUICK:
+            n = l <= QUICK_ELEM_STRING ? 1 : l <= QUICK_CALLC ? 5 : 0;
+            break;
+        case OP_END:
+            n = 1;
+            break;
+    }
+    return p + n > size ? 0 : n;
+}
+
+/* Maps every instruction to the operand of the nearest LINE before it in its function */
+static int *compute_lines(const bytefile *bf) {
+    const size_t size = (size_t) (bf->code_end - bf->code_ptr);
+    int *lines = calloc(size + 1, sizeof(int));
+    if (lines == NULL) {
+        failure("*** FAILURE: unable to allocate memory.\n");
+    }
+    int line = 0;
+    size_t n;
+    for (size_t p = 0; p < size && (n = insn_length(bf->code_ptr, size, p)) > 0; p += n) {
+        const unsigned char x = (unsigned char) bf->code_ptr[p];
+        if (x == ((OP_CTRL << 4) | CTRL_BEGIN) || x == ((OP_CTRL << 4) | CTRL_CBEGIN)) {
+            line = 0;
+        } else if (x == ((OP_CTRL << 4) | CTRL_LINE)) {
+            memcpy(&line, bf->code_ptr + p + 1, sizeof(int));
+        }
+        lines[p] = line;
+    }
+    return lines;
+}
+
+static void init_alloc_profile(const bytefile *bf) {
+    const char *value = getenv("LAMA_ALLOC_PROFILE");
+    if (value == NULL || *value == 0) {
+        return;
+    }
+    char *end;
+    const long period = strtol(value, &end, 10);
+    if (*end != 0 || period <= 0) {
+        failure("LAMA_ALLOC_PROFILE: invalid sampling period '%s'\n", value);
+    }
+    alloc_profile.enabled = true;
+    alloc_profile.period = (size_t) period;
+    alloc_profile.rng = 0x9E3779B97F4A7C15ull;
+    const char *seed = getenv("LAMA_ALLOC_PROFILE_SEED");
+    if (seed != NULL && *seed != 0) {
+        alloc_profile.rng = strtoull(seed, &end, 10);
+        if (*end != 0 || alloc_profile.rng == 0) {
+            failure("LAMA_ALLOC_PROFILE_SEED: invalid seed '%s'\n", seed);
+        }
+    }
+    alloc_profile.countdown = next_sample_distance();
+    alloc_profile.bf = bf;
+    alloc_profile.index = calloc(bf->code_end - bf->code_ptr + 1, sizeof(uint32_t));
+    if (alloc_profile.index == NULL) {
+        failure("*** FAILURE: unable to allocate memory.\n");
+    }
+    alloc_profile.lines = compute_lines(bf);
+    // other collectors may reuse memory of dead samples before they can be dropped
+    if (gc_collector == GC_COLLECTOR_LISP2 && gc_compaction == GC_COMPACTION_SLIDING && gc_mode == GC_MODE_STW) {
+        alloc_profile.sample = true;
+        gc_before_relocation = follow_alloc_samples;
+    }
+    atexit(report_alloc_profile);
+}
+
+#define PROFILE_ALLOCATION() do { if (alloc_profile.enabled) profile_allocation(insn); } while (0)
+
+/* Quickening: after its first execution an instruction may rewrite its opcode in the loaded
+   bytecode into an OP_QUICK variant specialised for what it has seen. A variant checks a guard
+   and, if it fails, does the generic work (and turns into the polymorphic variant if there is
+   one). Instruction lengths are kept, so jumps, stack maps and profiles are not affected; as
+   variants check everything they rely on, they are harmless in an input file too */
+#define QUICKEN(op) (*(unsigned char *) insn = (unsigned char) ((OP_QUICK << 4) | (op)))
+
+/* Inline cache of a CALLC site: the callee of the last call with its BEGIN decoded, so a call
+   of the same code goes straight to the function body */
+typedef struct {
+    int arg_number;
+    int target; // code offset of the cached callee, -1 if none
+    int num_args;
+    int local_size;
+} callc_cache;
+
+#define BEGIN_INSN_SIZE (1 + 2 * sizeof(int))
+
+static callc_cache *callc_caches = NULL;
+static size_t callc_caches_number = 0;
+static size_t callc_caches_capacity = 0;
+
+static int new_callc_cache(const int arg_number) {
+    if (callc_caches_number == callc_caches_capacity) {
+        callc_caches = grow_array(callc_caches, &callc_caches_capacity, sizeof(callc_cache));
+    }
+    callc_caches[callc_caches_number] = (callc_cache) {.arg_number = arg_number, .target = -1};
+    return (int) callc_caches_number++;
+}
+
+// caches the callee if it starts with BEGIN, otherwise it is left to the interpreter
+static void fill_callc_cache(const bytefile *bf, callc_cache *cache, const aint offset) {
+    cache->target = -1;
+    if (offset < 0 || offset + BEGIN_INSN_SIZE > code_size) {
+        return;
+    }
+    const char *begin = bf->code_ptr + offset;
+    const unsigned char x = (unsigned char) begin[0];
+    if (x != ((OP_CTRL << 4) | CTRL_BEGIN) && x != ((OP_CTRL << 4) | CTRL_CBEGIN)) {
+        return;
+    }
+    memcpy(&cache->num_args, begin + 1, sizeof(int));
+    memcpy(&cache->local_size, begin + 1 + sizeof(int), sizeof(int));
+    cache->target = (int) offset;
+}
+
+// calls the closure under the arguments, returns the ip to continue with
+static char *call_closure(const bytefile *bf, callc_cache *cache, char *ip) {
+    const aint offset = callc_function(cache->arg_number);
+    gc_safepoint();
+    operand_push((aint) ip, POINTER);
+    if (offset != cache->target) {
+        fill_callc_cache(bf, cache, offset);
+        return bf->code_ptr + offset;
+    }
+    begin_function(cache->num_args, cache->local_size);
+    return bf->code_ptr + offset + BEGIN_INSN_SIZE;
+}
+
 /* Disassembles the bytecode pool */
 void disassemble(FILE *f, bytefile *bf) {
     char *ip = bf->entry_ptr;
@@ -501,6 +1400,7 @@ void disassemble(FILE *f, bytefile *bf) {
 #define STRING get_string(bf, INT)
 #define FAIL failure("ERROR: invalid opcode %d-%d\n", h, l)
     do {
+        const char *insn = ip;
         unsigned char x = BYTE,
                 h = (x & 0xF0) >> 4,
                 l = x & 0x0F;
@@ -587,10 +1487,19 @@ void disassemble(FILE *f, bytefile *bf) {
                     }
 
                     case MI_STRING: {
-                        const char *s = STRING;
+                        const int pos = INT;
+                        const char *s = get_string(bf, pos);
                         DEBUG_LOG(f, "STRING\t%s", s);
-                        aint res = (aint) Bstring((aint *) &s);
-                        operand_push(res, POINTER);
+                        const uint32_t len = literal_lengths[pos];
+                        data *str = gc_alloc_string_inline(len);
+                        if (str == NULL) {
+                            safepoint_ip = ip;
+                            str = alloc_string(len);
+                            safepoint_ip = NULL;
+                        }
+                        memcpy(str->contents, s, len);
+                        operand_push((aint) str->contents, POINTER);
+                        PROFILE_ALLOCATION();
                         break;
                     }
 
@@ -599,7 +1508,10 @@ void disassemble(FILE *f, bytefile *bf) {
                         int elem_size = INT;
                         DEBUG_LOG(f, "SEXP\t%s ", tag);
                         DEBUG_LOG(f, "%d", elem_size);
+                        safepoint_ip = ip;
                         sexp_function(tag, elem_size);
+                        safepoint_ip = NULL;
+                        PROFILE_ALLOCATION();
                         break;
                     }
 
@@ -627,12 +1539,14 @@ void disassemble(FILE *f, bytefile *bf) {
                             failure("JMP target out of range: 0x%x\n", (unsigned) jump_address);
                         }
                         ip = bf->code_ptr + jump_address;
+                        gc_safepoint();
                         break;
                     }
 
                     case MI_END: {
                         DEBUG_LOG(f, "END\t");
                         aint return_address = end_function();
+                        gc_safepoint();
                         if (return_address == 0) {
                             goto stop;
                         }
@@ -677,6 +1591,7 @@ void disassemble(FILE *f, bytefile *bf) {
                         operand_pop();
 
                         void *res = Belem((void *) a, BOX(b));
+                        QUICKEN(elem_variant(a));
                         operand_push((aint) res, UNKNOWN);
                         break;
                     }
@@ -734,6 +1649,7 @@ void disassemble(FILE *f, bytefile *bf) {
                             store_closure(num_args);
                         } else if (h == OP_LD) {
                             load_closure(num_args);
+                            QUICKEN(QUICK_LD_C);
                         } else {
                             failure("C is not supported");
                         }
@@ -756,6 +1672,7 @@ void disassemble(FILE *f, bytefile *bf) {
                                 failure("CJMPz target out of range: 0x%x\n", (unsigned) target);
                             }
                             ip = bf->code_ptr + target;
+                            gc_safepoint();
                         }
                         break;
                     }
@@ -770,6 +1687,7 @@ void disassemble(FILE *f, bytefile *bf) {
                                 failure("CJMPnz target out of range: 0x%x\n", (unsigned) target);
                             }
                             ip = bf->code_ptr + target;
+                            gc_safepoint();
                         }
                         break;
                     }
@@ -818,16 +1736,21 @@ void disassemble(FILE *f, bytefile *bf) {
                                     FAIL;
                             }
                         }
+                        safepoint_ip = ip;
                         closure_function(code_pntr, n);
+                        safepoint_ip = NULL;
+                        PROFILE_ALLOCATION();
                         break;
                     }
 
                     case CTRL_CALLC: {
                         int arg_number = INT;
                         DEBUG_LOG(f, "CALLC\t%d", arg_number);
-                        aint offset = callc_function(arg_number);
-                        operand_push((aint) ip, POINTER);
-                        ip = bf->code_ptr + offset;
+                        // the operand becomes the index of the site's cache
+                        const int site = new_callc_cache(arg_number);
+                        memcpy((char *) insn + 1, &site, sizeof(int));
+                        QUICKEN(QUICK_CALLC);
+                        ip = call_closure(bf, &callc_caches[site], ip);
                         break;
                     }
 
@@ -837,6 +1760,7 @@ void disassemble(FILE *f, bytefile *bf) {
                         DEBUG_LOG(f, "CALL\t0x%.8x ", call_pos);
                         DEBUG_LOG(f, "%d", number_of_args);
                         reverse_last_el(number_of_args);
+                        gc_safepoint();
                         operand_push(0, VAL);
                         operand_push((aint) ip, POINTER);
                         ip = bf->code_ptr + call_pos;
@@ -964,13 +1888,19 @@ void disassemble(FILE *f, bytefile *bf) {
 
                     case RT_STRING:
                         DEBUG_LOG(f, "CALL\tLstring");
+                        safepoint_ip = ip;
                         operand_push((aint) Lstring(SP_ptr()), POINTER);
+                        safepoint_ip = NULL;
+                        PROFILE_ALLOCATION();
                         break;
 
                     case RT_BARRAY: {
                         int size = INT;
                         DEBUG_LOG(f, "CALL\tBarray\t%d", size);
+                        safepoint_ip = ip;
                         barray_function(size);
+                        safepoint_ip = NULL;
+                        PROFILE_ALLOCATION();
                         break;
                     }
 
@@ -980,6 +1910,55 @@ void disassemble(FILE *f, bytefile *bf) {
             }
             break;
 
+            case OP_QUICK:
+                switch (l) {
+                    case QUICK_ELEM:
+                    case QUICK_ELEM_ARRAY:
+                    case QUICK_ELEM_SEXP:
+                    case QUICK_ELEM_STRING: {
+                        DEBUG_LOG(f, "ELEM");
+                        const aint index = operand_top(VAL);
+                        operand_pop();
+                        const aint container = operand_top(POINTER);
+                        operand_pop();
+                        aint res;
+                        if (l != QUICK_ELEM && elem_variant(container) == l) {
+                            const data *d = TO_DATA(container);
+                            res = l == QUICK_ELEM_STRING
+                                      ? BOX((char) d->contents[index])
+                                      : field_load(&FIELDS(d->contents)[index]);
+                        } else {
+                            if (l != QUICK_ELEM) {
+                                QUICKEN(QUICK_ELEM);
+                            }
+                            res = (aint) Belem((void *) container, BOX(index));
+                        }
+                        operand_push(res, UNKNOWN);
+                        break;
+                    }
+
+                    case QUICK_LD_C: {
+                        const int k = INT;
+                        DEBUG_LOG(f, "LD\tC(%d)", k);
+                        load_closure_quick(k);
+                        break;
+                    }
+
+                    case QUICK_CALLC: {
+                        const int site = INT;
+                        if (site < 0 || (size_t) site >= callc_caches_number) {
+                            FAIL;
+                        }
+                        DEBUG_LOG(f, "CALLC\t%d", callc_caches[site].arg_number);
+                        ip = call_closure(bf, &callc_caches[site], ip);
+                        break;
+                    }
+
+                    default:
+                        FAIL;
+                }
+                break;
+
             default:
                 FAIL;
         }
@@ -996,8 +1975,16 @@ void dump_file(FILE *f, bytefile *bf) {
 
     DEBUG_LOG(f, "String table size       : %d\n", bf->stringtab_size);
     DEBUG_LOG(f, "Global area size        : %d\n", bf->global_area_size);
-    // Places reserved for global variables
-    set_stack_top_index((size_t) (STACK_SIZE - bf->global_area_size));
+    if (bf->global_area_size < 0) {
+        failure("Incorrect bytecode file: negative global_area_size");
+    }
+    globals_number = (size_t) bf->global_area_size;
+    globals = calloc(MAX(globals_number, 1), sizeof(aint));
+    if (globals == NULL) {
+        failure("*** FAILURE: unable to allocate memory.\n");
+    }
+    gc_register_root_region("globals", (size_t *) globals, (size_t *) (globals + globals_number));
+    set_stack_top_index(STACK_SIZE);
     operand_push(-1, VAL);
     operand_push(-1, VAL);
     DEBUG_LOG(f, "Number of public symbols: %d\n", bf->public_symbols_number);
@@ -1029,10 +2016,18 @@ void dump_file(FILE *f, bytefile *bf) {
 int main(int argc, char *argv[]) {
     // stack_top < stack_bottom
     __gc_init();
+    gc_enable_safepoints();
     __gc_stack_top= (size_t) &g_stack.operand_stack[0];
     __gc_stack_bottom = (size_t) &g_stack.operand_stack[STACK_SIZE];
 
     bytefile *f = read_file(argv[1]);
+    compute_literal_lengths(f);
+    code_size = (size_t) (f->code_end - f->code_ptr);
+    init_alloc_profile(f);
+    // without stack maps every local of a frame is passed to GC
+    build_stack_maps(f);
+    gc_stack_roots = live_stack_slots;
     dump_file(stderr, f);
+    gc_heap_dump_at_exit();
     return 0;
 }
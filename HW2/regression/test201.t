@@ -0,0 +1,2 @@
+  $ ../src/Driver.exe -runtime ../runtime -I ../stdlib/x64 -i test201.lama < test201.input
+   > 899997
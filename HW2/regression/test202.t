@@ -0,0 +1,3 @@
+  $ ../src/Driver.exe -runtime ../runtime -I ../stdlib/x64 -i test202.lama < test202.input
+  489000
+  9099000
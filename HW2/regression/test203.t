@@ -0,0 +1,2 @@
+  $ ../src/Driver.exe -runtime ../runtime -I ../stdlib/x64 -i test203.lama < test203.input
+   > 50005000
@@ -0,0 +1,3 @@
+  $ ../src/Driver.exe -runtime ../runtime -I ../stdlib/x64 -i test204.lama < test204.input
+  70000
+  15750
@@ -1,10 +1,29 @@
 import os
 import subprocess
 import glob
+import sys
+import tempfile
 
 
 regression_dir = "./regression"
-exe = "./cmake-build-debug/hw2"
+exe = sys.argv[1] if len(sys.argv) > 1 else "./cmake-build-debug/hw2"
+analyser = os.path.join(os.path.dirname(exe), "heap_analyser")
+dump_file = os.path.join(tempfile.gettempdir(), "lama_regression.dump")
+
+# Каждый тест прогоняется во всех конфигурациях сборщика мусора.
+# Конфигурации, которые сборка не поддерживает (например, immix при
+# LAMA_COMPRESSED_REFS), пропускаются.
+configurations = [
+    {},
+    {"LAMA_GC_THREADS": "1"},
+    {"LAMA_GC_THREADS": "4"},
+    {"LAMA_GC_COMPACTION": "dfs"},
+    {"LAMA_GC_MODE": "incremental"},
+    {"LAMA_GC_MODE": "concurrent"},
+    {"LAMA_GC": "immix"},
+    {"LAMA_GC": "semispace"},
+    {"LAMA_HEAP_DUMP": dump_file},
+]
 
 def clean_lines(text):
     lines = text.splitlines()
@@ -19,47 +38,77 @@ def clean_lines(text):
             cleaned.append(line)
     return cleaned
 
+def config_name(config):
+    return " ".join(f"{k}={v}" for k, v in config.items()) or "default"
+
+# Дамп кучи должен читаться анализатором, и все объекты в нём должны быть достижимы
+def check_heap_dump():
+    if not os.path.isfile(analyser):
+        return True
+    result = subprocess.run([analyser, dump_file], stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, text=True)
+    return result.returncode == 0 and " 0 objects are not reachable" in result.stdout
+
 total_tests = 0
 passed_tests = 0
 failed_tests = 0
 
+tests = []
 for bc_file in sorted(glob.glob(os.path.join(regression_dir, "test*.bc"))):
     filename = os.path.basename(bc_file).rsplit(".bc", 1)[0]
     input_file = os.path.join(regression_dir, f"{filename}.input")
     answer_file = os.path.join(regression_dir, f"{filename}.t")
 
-    if not os.path.isfile(input_file) or not os.path.isfile(answer_file):
-        continue
-
-    total_tests += 1
-
-    result = subprocess.run(
-        [exe, bc_file],
-        stdin=open(input_file, "r"),
-        stdout=subprocess.PIPE,
-        stderr=subprocess.DEVNULL,
-        text=True
-    )
-
-    # Чистим вывод и эталон
-    output_clean = clean_lines(result.stdout)
-    with open(answer_file, "r", encoding="utf-8") as f:
-        answer_clean = clean_lines(f.read())
-
-    if output_clean == answer_clean:
-        print(f"{filename}: ✅ OK")
-        passed_tests += 1
-    else:
-        print(f"{filename}: ❌ MISMATCH")
-        print("Output:")
-        print("\n".join(output_clean))
-        print("Expected:")
-        print("\n".join(answer_clean))
-        print("-" * 40)
-        failed_tests += 1
+    if os.path.isfile(input_file) and os.path.isfile(answer_file):
+        tests.append((filename, bc_file, input_file, answer_file))
+
+skipped_configs = []
+for config in configurations:
+    name = config_name(config)
+    env = dict(os.environ, **config)
+    for filename, bc_file, input_file, answer_file in tests:
+        if os.path.exists(dump_file):
+            os.remove(dump_file)
+
+        result = subprocess.run(
+            [exe, bc_file],
+            stdin=open(input_file, "r"),
+            stdout=subprocess.PIPE,
+            stderr=subprocess.PIPE,
+            env=env,
+            text=True
+        )
+
+        if result.returncode != 0 and "supported only" in result.stderr:
+            skipped_configs.append(f"{name}: {result.stderr.strip()}")
+            break
+
+        total_tests += 1
+
+        # Чистим вывод и эталон
+        output_clean = clean_lines(result.stdout)
+        with open(answer_file, "r", encoding="utf-8") as f:
+            answer_clean = clean_lines(f.read())
+
+        dump_ok = "LAMA_HEAP_DUMP" not in config or check_heap_dump()
+        if output_clean == answer_clean and dump_ok:
+            print(f"{filename} [{name}]: ✅ OK")
+            passed_tests += 1
+        else:
+            print(f"{filename} [{name}]: ❌ MISMATCH" if dump_ok else f"{filename} [{name}]: ❌ BAD HEAP DUMP")
+            print("Output:")
+            print("\n".join(output_clean))
+            print("Expected:")
+            print("\n".join(answer_clean))
+            print("-" * 40)
+            failed_tests += 1
+
+if os.path.exists(dump_file):
+    os.remove(dump_file)
 
 print("\n" + "="*40)
 print(f"Total tests: {total_tests}")
+for skipped in skipped_configs:
+    print(f"Skipped {skipped}")
 print(f"✅ Passed: {passed_tests}")
 print(f"❌ Failed: {failed_tests}")
 if total_tests > 0:
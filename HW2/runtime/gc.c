@@ -22,7 +22,7 @@ static const size_t INIT_HEAP_SIZE = MINIMUM_HEAP_CAPACITY;
 size_t cur_id = 0;
 #endif
 
-static extra_roots_pool extra_roots;
+extra_roots_pool extra_roots;
 
 size_t __gc_stack_top = 0, __gc_stack_bottom = 0;
 #ifdef LAMA_ENV
@@ -34,12 +34,50 @@ extern const size_t __stop_custom_data __asm("section$end$__DATA$custom_data");
 #endif
 #endif
 
-#ifdef DEBUG_VERSION
 memory_chunk heap;
-#else
-static memory_chunk heap;
+size_t      *gc_alloc_limit = NULL;
+void (*gc_stack_roots) (void (*add) (size_t *begin, size_t *end)) = NULL;
+void (*gc_before_relocation) (void) = NULL;
+bool         gc_safepoints_enabled = false;
+volatile bool gc_requested         = false;
+
+#ifdef LAMA_COMPACT_HEADERS
+#  ifdef FULL_INVARIANT_CHECKS
+#    error "FULL_INVARIANT_CHECKS keeps traversal marks in forward_address, compact headers do not have it"
+#  endif
+// Objects have no word for GC. A marked object of lisp2 heap has the bits of all its
+// words set in 'mark_bitmap'; compute_locations sets 'block_offsets[b]' to the number
+// of live words in the first b * WORD_BITS words of the heap, so a new location is
+// found by a popcount (see get_forward_address). Both tables cover the heap
+// reservation, their pages are committed on demand.
+static size_t *mark_bitmap   = NULL;
+static size_t *block_offsets = NULL;
+
+#  define SIDE_TABLE_WORDS (GC_HEAP_RESERVE_SIZE / WORD_BITS + 1)
+
+static size_t *map_side_table (void) {
+  size_t *table = mmap(NULL,
+                       WORDS_TO_BYTES(SIDE_TABLE_WORDS),
+                       PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                       -1,
+                       0);
+  if (table == MAP_FAILED) {
+    perror("ERROR: map_side_table: mmap failed\n");
+    exit(1);
+  }
+  return table;
+}
+
+// index of the header of obj from the start of the heap
+static inline size_t header_index (void *obj) { return (size_t *)TO_DATA(obj) - heap.begin; }
 #endif
 
+gc_collector_kind gc_collector = GC_COLLECTOR_LISP2;
+gc_mode_kind      gc_mode      = GC_MODE_STW;
+gc_compaction_kind gc_compaction = GC_COMPACTION_SLIDING;
+size_t       gc_pause_budget_us = GC_DEFAULT_PAUSE_BUDGET_US;
+
 #ifdef DEBUG_VERSION
 void dump_heap ();
 #endif
@@ -55,6 +93,41 @@ void handler (int sig) {
   exit(1);
 }
 
+bool gc_enable_safepoints (void) {
+  gc_safepoints_enabled = gc_collector == GC_COLLECTOR_LISP2 && gc_mode == GC_MODE_STW
+                          && gc_compaction == GC_COMPACTION_SLIDING;
+  return gc_safepoints_enabled;
+}
+
+// words added to heap.size by gc_alloc_in_reserve since the last collection, they are
+// not a part of the capacity chosen by next_heap_capacity
+static size_t reserve_extension_words = 0;
+
+// extends the heap in its reservation instead of collecting, see gc_safepoint
+static void *gc_alloc_in_reserve (size_t size) {
+  size_t extension = MAX(size, GC_SAFEPOINT_RESERVE);
+  if (heap.size + extension > GC_HEAP_RESERVE_SIZE) {
+    fprintf(stderr, "ERROR: gc_alloc_in_reserve: heap reservation of %zu words is exhausted\n", (size_t)GC_HEAP_RESERVE_SIZE);
+    exit(1);
+  }
+  heap.end                += extension;
+  heap.size               += extension;
+  reserve_extension_words += extension;
+  gc_alloc_limit           = heap.end;
+  gc_requested             = true;
+  return gc_alloc_on_existing_heap(size);
+}
+
+void gc_collect_at_safepoint (void) {
+  gc_requested = false;
+  // a dump collects the heap itself
+  if (gc_heap_dump_pending()) {
+    gc_heap_dump_at_safepoint();
+    return;
+  }
+  gc_collect(0);
+}
+
 void *alloc (size_t size) {
 #ifdef DEBUG_VERSION
   ++cur_id;
@@ -65,12 +138,12 @@ void *alloc (size_t size) {
 #if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
   fprintf(stderr, "allocation of size %zu words (%zu bytes): ", size, bytes_sz);
 #endif
-  void *p = gc_alloc_on_existing_heap(size);
+  void *p = gc_los_enabled && size >= GC_LARGE_OBJECT_SIZE ? los_alloc(size) : gc_alloc_on_existing_heap(size);
   if (!p) {
 //    fprintf(stderr, "Garbage collection is not implemented yet.\n");
 //    exit(149);
-    // not enough place in the heap, need to perform GC cycle
-     p = gc_alloc(size);
+    // not enough place in the heap, need to perform GC cycle (or to ask for it)
+    p = gc_safepoints_enabled ? gc_alloc_in_reserve(size) : gc_alloc(size);
   }
 #ifdef DEBUG_PRINT
   printf("Object allocated: content [%p, %p) padding [%p, %p)\n", p, p + obj_size, p + obj_size, p + size * sizeof(size_t));
@@ -79,6 +152,51 @@ void *alloc (size_t size) {
   return p;
 }
 
+// chunks of permanent objects, they are never freed; the last one is being filled.
+// As in the heap, the content of an object without fields may end its chunk
+static memory_chunk *permanent_chunks          = NULL;
+static size_t        permanent_chunks_number   = 0;
+static size_t        permanent_chunks_capacity = 0;
+
+void *alloc_permanent (size_t bytes) {
+#ifdef LAMA_COMPRESSED_REFS
+  return NULL;
+#else
+  size_t        words = BYTES_TO_WORDS(bytes);
+  memory_chunk *last  = permanent_chunks_number == 0 ? NULL : &permanent_chunks[permanent_chunks_number - 1];
+  if (last == NULL || last->current + words > last->end) {
+    if (permanent_chunks_number == permanent_chunks_capacity) {
+      permanent_chunks_capacity = MAX(2 * permanent_chunks_capacity, 4);
+      permanent_chunks = realloc(permanent_chunks, permanent_chunks_capacity * sizeof(memory_chunk));
+      if (permanent_chunks == NULL) {
+        perror("ERROR: alloc_permanent: realloc failed\n");
+        exit(1);
+      }
+    }
+    size_t chunk_size = MAX(words, (size_t)GC_PERMANENT_CHUNK_SIZE);
+    last              = &permanent_chunks[permanent_chunks_number++];
+    last->begin       = calloc(chunk_size, sizeof(size_t));
+    if (last->begin == NULL) {
+      perror("ERROR: alloc_permanent: calloc failed\n");
+      exit(1);
+    }
+    last->current = last->begin;
+    last->end     = last->begin + chunk_size;
+    last->size    = chunk_size;
+  }
+  void *p = last->current;
+  last->current += words;
+  return p;
+#endif
+}
+
+bool is_permanent_pointer (const void *p) {
+  for (size_t i = 0; i < permanent_chunks_number; ++i) {
+    if ((size_t *)p > permanent_chunks[i].begin && (size_t *)p <= permanent_chunks[i].current) { return true; }
+  }
+  return false;
+}
+
 #ifdef FULL_INVARIANT_CHECKS
 
 // precondition: obj_content is a valid address pointing to the content of an object
@@ -126,7 +244,7 @@ static void objects_dfs (FILE *f, void *obj_content) {
   for (obj_field_iterator field_it = ptr_field_begin_iterator(obj_header);
        !field_is_done_iterator(&field_it);
        obj_next_field_iterator(&field_it)) {
-    size_t field_value = *(size_t *)field_it.cur_field;
+    size_t field_value = field_load(field_it.cur_field);
     if (is_valid_heap_pointer((size_t *)field_value)) {
       print_object_info(f, (void *)field_value);
       /*fprintf(f, "%zu ", TO_DATA(field_value)->id);*/
@@ -138,7 +256,7 @@ static void objects_dfs (FILE *f, void *obj_content) {
   for (obj_field_iterator field_it = ptr_field_begin_iterator(obj_header);
        !field_is_done_iterator(&field_it);
        obj_next_field_iterator(&field_it)) {
-    size_t field_value = *(size_t *)field_it.cur_field;
+    size_t field_value = field_load(field_it.cur_field);
     if (is_valid_heap_pointer((size_t *)field_value)) { objects_dfs(f, (void *)field_value); }
   }
 }
@@ -187,16 +305,24 @@ int files_cmp (FILE *f1, FILE *f2) {
 #endif
 
 void *gc_alloc_on_existing_heap (size_t size) {
-  if (heap.current + size <= heap.end) {
+  if (heap.current + size <= gc_alloc_limit) {
     void *p = (void *)heap.current;
     heap.current += size;
-    memset(p, 0, size * sizeof(size_t));
     return p;
   }
   return NULL;
 }
 
 void *gc_alloc (size_t size) {
+  if (gc_collector == GC_COLLECTOR_IMMIX) { return immix_alloc(size); }
+  if (gc_collector == GC_COLLECTOR_SEMISPACE) {
+    gc_stats_cycle_begin(heap.current - heap.begin);
+    semispace_collect(size);
+    gc_stats_cycle_end(heap.current - heap.begin, heap.size);
+    return gc_alloc_on_existing_heap(size);
+  }
+  if (gc_mode == GC_MODE_INCREMENTAL) { return incremental_alloc(size); }
+  if (gc_mode == GC_MODE_CONCURRENT) { return concurrent_alloc(size); }
 #ifdef DEBUG_PRINT
   printf("Reallocation!\n");
 #endif
@@ -204,17 +330,31 @@ void *gc_alloc (size_t size) {
 #if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
   fprintf(stderr, "===============================GC cycle has started\n");
 #endif
+  gc_collect(size);
+#if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
+  fprintf(stderr, "===============================GC cycle has finished\n");
+#endif
+  return gc_alloc_on_existing_heap(size);
+}
+
+// words occupied by objects of lisp2 heap, including large ones
+static size_t used_words (void) { return (heap.current - heap.begin) + los_words(); }
+
+void gc_collect (size_t additional_size) {
+  gc_stats_cycle_begin(used_words());
 #ifdef FULL_INVARIANT_CHECKS
   FILE *stack_before = print_stack_content("stack-dump-before-compaction");
   FILE *heap_before  = print_objects_traversal("before-mark", 0);
   fclose(heap_before);
 #endif
+  uint64_t t = gc_stats_now();
   mark_phase();
+  gc_stats_phase(GC_PHASE_MARK, t);
 #ifdef FULL_INVARIANT_CHECKS
   FILE *heap_before_compaction = print_objects_traversal("after-mark", 1);
 #endif
 
-  compact_phase(size);
+  compact_phase(additional_size);
 #ifdef FULL_INVARIANT_CHECKS
   FILE *stack_after           = print_stack_content("stack-dump-after-compaction");
   FILE *heap_after_compaction = print_objects_traversal("after-compaction", 0);
@@ -234,77 +374,208 @@ void *gc_alloc (size_t size) {
   fclose(heap_before_compaction);
   fclose(heap_after_compaction);
 #endif
-#if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
-  fprintf(stderr, "===============================GC cycle has finished\n");
+  gc_stats_cycle_end(used_words(), heap.size);
+}
+
+// root areas added by gc_register_root_region, the stack and the global area take the rest
+static root_region registered_regions[MAX_ROOT_REGIONS - 2];
+static const char *registered_names[MAX_ROOT_REGIONS - 2];
+static size_t      registered_regions_number = 0;
+
+void gc_register_root_region (const char *name, size_t *begin, size_t *end) {
+  if (registered_regions_number == MAX_ROOT_REGIONS - 2) {
+    fprintf(stderr, "ERROR: gc_register_root_region: too many root regions\n");
+    exit(1);
+  }
+  registered_names[registered_regions_number]     = name;
+  registered_regions[registered_regions_number++] = (root_region){begin, end};
+}
+
+static bool in_registered_regions (void *p) {
+  for (size_t i = 0; i < registered_regions_number; ++i) {
+    if (p >= (void *)registered_regions[i].begin && p < (void *)registered_regions[i].end) { return true; }
+  }
+  return false;
+}
+
+// regions returned by the last gc_root_regions, the parts of the stack go first
+static root_region *root_regions          = NULL;
+static size_t       root_regions_number   = 0;
+static size_t       root_regions_capacity = 0;
+static size_t       stack_regions_number  = 0;
+
+static void append_root_region (size_t *begin, size_t *end) {
+  if (root_regions_number == root_regions_capacity) {
+    root_regions_capacity = MAX(2 * root_regions_capacity, MAX_ROOT_REGIONS);
+    root_regions          = realloc(root_regions, root_regions_capacity * sizeof(root_region));
+    if (root_regions == NULL) {
+      perror("ERROR: gc_root_regions: realloc failed\n");
+      exit(1);
+    }
+  }
+  root_regions[root_regions_number++] = (root_region){begin, end};
+}
+
+static void add_stack_region (size_t *begin, size_t *end) {
+  if (begin < end) { append_root_region(begin, end); }
+}
+
+static size_t *stack_base (void) { return (size_t *)(__gc_stack_top + sizeof(size_t)); }
+
+size_t gc_root_regions (const root_region **regions) {
+  root_regions_number = 0;
+  if (gc_stack_roots != NULL) {
+    gc_stack_roots(add_stack_region);
+  } else {
+    add_stack_region(stack_base(), (size_t *)__gc_stack_bottom);
+  }
+  stack_regions_number = root_regions_number;
+#ifdef LAMA_ENV
+  append_root_region((size_t *)&__start_custom_data, (size_t *)&__stop_custom_data);
 #endif
-  return gc_alloc_on_existing_heap(size);
+  for (size_t i = 0; i < registered_regions_number; ++i) {
+    append_root_region(registered_regions[i].begin, registered_regions[i].end);
+  }
+  *regions = root_regions;
+  return root_regions_number;
 }
 
-static void gc_root_scan_stack () {
-  for (size_t *p = (size_t *)(__gc_stack_top + sizeof(size_t)); p < (size_t *)__gc_stack_bottom; ++p) {
-    gc_test_and_mark_root((size_t **)p);
+const char *gc_root_region_name (size_t i) {
+  if (i < stack_regions_number) { return "stack"; }
+  i -= stack_regions_number;
+#ifdef LAMA_ENV
+  if (i == 0) { return "static"; }
+  --i;
+#endif
+  return registered_names[i];
+}
+
+size_t *gc_root_region_base (size_t i) {
+  return i < stack_regions_number ? stack_base() : root_regions[i].begin;
+}
+
+static void scan_root_regions (void) {
+  const root_region *regions;
+  size_t             n = gc_root_regions(&regions);
+  for (size_t r = 0; r < n; ++r) {
+    for (size_t *p = regions[r].begin; p < regions[r].end; ++p) { gc_test_and_mark_root((size_t **)p); }
   }
 }
 
 void mark_phase (void) {
+#ifdef LAMA_COMPACT_HEADERS
+  // marks of the previous collection are dropped here, see unmark_object
+  memset(mark_bitmap, 0, WORDS_TO_BYTES((heap.current - heap.begin) / WORD_BITS + 1));
+#endif
+  if (gc_parallel_enabled()) {
+    parallel_mark_phase();
+    return;
+  }
 #if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
   fprintf(stderr, "marking has started\n");
   fprintf(stderr,
-          "gc_root_scan_stack has started: gc_top=%p bot=%p\n",
+          "scan_root_regions has started: gc_top=%p bot=%p\n",
           (void *)__gc_stack_top,
           (void *)__gc_stack_bottom);
 #endif
-  gc_root_scan_stack();
+  scan_root_regions();
 #if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
-  fprintf(stderr, "gc_root_scan_stack has finished\n");
+  fprintf(stderr, "scan_root_regions has finished\n");
   fprintf(stderr, "scan_extra_roots has started\n");
 #endif
   scan_extra_roots();
 #if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
   fprintf(stderr, "scan_extra_roots has finished\n");
-  fprintf(stderr, "scan_global_area has started\n");
-#endif
-#ifdef LAMA_ENV
-  scan_global_area();
-#endif
-#if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
-  fprintf(stderr, "scan_global_area has finished\n");
   fprintf(stderr, "marking has finished\n");
 #endif
 }
 
-void compact_phase (size_t additional_size) {
-  size_t live_size = compute_locations();
+// number of collections in a row after which the heap was at least GC_SHRINK_RATIO times bigger than needed
+static size_t oversized_collections = 0;
 
-  // all in words
-  size_t next_heap_size =
+size_t next_heap_capacity (size_t live_size, size_t additional_size) {
+  // the emergency extension made before a safepoint is given back
+  size_t capacity         = heap.size - reserve_extension_words;
+  reserve_extension_words = 0;
+  size_t needed =
       MAX(live_size * EXTRA_ROOM_HEAP_COEFFICIENT + additional_size, MINIMUM_HEAP_CAPACITY);
-  size_t next_heap_pseudo_size = MAX(next_heap_size, heap.size);
+  if (needed * GC_SHRINK_RATIO > capacity) {
+    oversized_collections = 0;
+    return MAX(needed, capacity);
+  }
+  if (++oversized_collections < GC_SHRINK_COLLECTIONS) { return capacity; }
+  oversized_collections = 0;
+  return needed;
+}
 
-  memory_chunk old_heap = heap;
-  heap.begin            = mmap(NULL, WORDS_TO_BYTES(next_heap_pseudo_size), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-  memcpy(heap.begin, old_heap.begin, WORDS_TO_BYTES(old_heap.size));
-  if (heap.begin == MAP_FAILED) {
-    perror("ERROR: compact_phase: mmap failed\n");
+// returns pages of the reservation between heap.end and end to the OS, they stay reserved
+static void release_heap_tail (size_t *end) {
+  size_t page  = sysconf(_SC_PAGESIZE);
+  size_t begin = ((size_t)heap.end + page - 1) & ~(page - 1);
+  if (begin < (size_t)end && madvise((void *)begin, (size_t)end - begin, MADV_DONTNEED) < 0) {
+    perror("ERROR: release_heap_tail: madvise failed\n");
     exit(1);
   }
-  heap.end     = heap.begin + next_heap_pseudo_size;
-  heap.size    = next_heap_pseudo_size;
-  heap.current = heap.begin + (old_heap.current - old_heap.begin);
+}
 
-  update_references(&old_heap);
-  physically_relocate(&old_heap);
+void compact_phase (size_t additional_size) {
+  if (gc_compaction == GC_COMPACTION_DFS) {
+    dfs_compact_phase(additional_size);
+    return;
+  }
+  // heap has not changed since mark_phase, so this is the same decision it has made
+  bool     parallel  = gc_parallel_enabled();
+  uint64_t t         = gc_stats_now();
+  size_t   live_size = parallel ? parallel_compute_locations() : compute_locations();
+  gc_stats_phase(GC_PHASE_COMPUTE_LOCATIONS, t);
+  if (gc_before_relocation != NULL) { gc_before_relocation(); }
 
-  heap.current = heap.begin + live_size;
-  if (munmap(old_heap.begin, old_heap.size) < 0) {
-      perror("ERROR: compact_phase: munmap failed\n");
-      exit(1);
+  // all in words
+  size_t next_heap_size = next_heap_capacity(live_size, additional_size);
+  if (next_heap_size > GC_HEAP_RESERVE_SIZE) {
+    fprintf(stderr, "ERROR: compact_phase: heap reservation of %zu words is exhausted\n", (size_t)GC_HEAP_RESERVE_SIZE);
+    exit(1);
   }
+
+  // the heap is compacted in place: old_heap and heap differ only in their end
+  memory_chunk old_heap = heap;
+  heap.end              = heap.begin + next_heap_size;
+  heap.size             = next_heap_size;
+
+  t = gc_stats_now();
+  if (parallel) {
+    parallel_update_references(&old_heap);
+  } else {
+    update_references(&old_heap);
+  }
+  // large objects are not moved, only their fields are updated
+  los_fix_references(&old_heap);
+  gc_stats_phase(GC_PHASE_UPDATE_REFERENCES, t);
+  t = gc_stats_now();
+  if (parallel) {
+    parallel_physically_relocate(&old_heap);
+  } else {
+    physically_relocate(&old_heap);
+  }
+  gc_stats_phase(GC_PHASE_PHYSICALLY_RELOCATE, t);
+
+  heap.current   = heap.begin + live_size;
+  gc_alloc_limit = heap.end;
+  if (heap.end < old_heap.end) { release_heap_tail(old_heap.end); }
+  los_sweep();
 }
 
 size_t compute_locations () {
 #if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
   fprintf(stderr, "GC compute_locations started\n");
+#endif
+#ifdef LAMA_COMPACT_HEADERS
+  size_t live = 0;
+  for (size_t b = 0; b <= (heap.current - heap.begin) / WORD_BITS; ++b) {
+    block_offsets[b] = live;
+    live += __builtin_popcountl(mark_bitmap[b]);
+  }
+  return live;
 #endif
   size_t       *free_ptr  = heap.begin;
   heap_iterator scan_iter = heap_begin_iterator();
@@ -360,6 +631,7 @@ void scan_and_fix_region_roots (memory_chunk *old_heap) {
     // skip this one since it was already fixed from scanning the stack
     if ((extra_roots.roots[i] >= (void **)__gc_stack_top
          && extra_roots.roots[i] < (void **)__gc_stack_bottom)
+        || in_registered_regions(extra_roots.roots[i])
 #ifdef LAMA_ENV
         || (extra_roots.roots[i] <= (void **)&__stop_custom_data
             && extra_roots.roots[i] >= (void **)&__start_custom_data)
@@ -420,55 +692,53 @@ void scan_and_fix_region_roots (memory_chunk *old_heap) {
 #endif
 }
 
+void fix_object_references (memory_chunk *old_heap, void *header_ptr) {
+  for (obj_field_iterator field_iter = ptr_field_begin_iterator(header_ptr);
+       !field_is_done_iterator(&field_iter);
+       obj_next_ptr_field_iterator(&field_iter)) {
+
+    size_t *field_value = (size_t *)field_load(field_iter.cur_field);
+    if (field_value < old_heap->begin || field_value > old_heap->current) { continue; }
+    // this pointer should also be modified according to old_heap->begin
+    void *field_obj_content_addr = (void *)heap.begin + ((void *)field_value - (void *)old_heap->begin);
+    // important, we calculate new_addr very carefully here, because objects may relocate to another memory chunk
+    void *new_addr =
+        heap.begin
+        + ((size_t *)get_forward_address(field_obj_content_addr) - (size_t *)old_heap->begin);
+    // update field reference to point to new_addr
+    // since, we want fields to point to an actual content, we need to add this extra content_offset
+    // because forward_address itself is a pointer to the object's header
+    size_t content_offset = get_header_size(get_type_row_ptr(field_obj_content_addr));
+#ifdef DEBUG_VERSION
+    if (!is_valid_heap_pointer((void *)(new_addr + content_offset))) {
+#  ifdef DEBUG_PRINT
+      fprintf(stderr,
+              "ur: incorrect pointer assignment: on object with id %d",
+              TO_DATA(get_object_content_ptr(header_ptr))->id);
+#  endif
+      exit(1);
+    }
+#endif
+    field_store(field_iter.cur_field, (aint)(new_addr + content_offset));
+  }
+}
+
 void update_references (memory_chunk *old_heap) {
 #if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
   fprintf(stderr, "GC update_references started\n");
 #endif
   heap_iterator it = heap_begin_iterator();
   while (!heap_is_done_iterator(&it)) {
-    if (is_marked(get_object_content_ptr(it.current))) {
-      for (obj_field_iterator field_iter = ptr_field_begin_iterator(it.current);
-           !field_is_done_iterator(&field_iter);
-           obj_next_ptr_field_iterator(&field_iter)) {
-
-        size_t *field_value = *(size_t **)field_iter.cur_field;
-        if (field_value < old_heap->begin || field_value > old_heap->current) { continue; }
-        // this pointer should also be modified according to old_heap->begin
-        void *field_obj_content_addr =
-            (void *)heap.begin + (*(void **)field_iter.cur_field - (void *)old_heap->begin);
-        // important, we calculate new_addr very carefully here, because objects may relocate to another memory chunk
-        void *new_addr =
-            heap.begin
-            + ((size_t *)get_forward_address(field_obj_content_addr) - (size_t *)old_heap->begin);
-        // update field reference to point to new_addr
-        // since, we want fields to point to an actual content, we need to add this extra content_offset
-        // because forward_address itself is a pointer to the object's header
-        size_t content_offset = get_header_size(get_type_row_ptr(field_obj_content_addr));
-#ifdef DEBUG_VERSION
-        if (!is_valid_heap_pointer((void *)(new_addr + content_offset))) {
-#  ifdef DEBUG_PRINT
-          fprintf(stderr,
-                  "ur: incorrect pointer assignment: on object with id %d",
-                  TO_DATA(get_object_content_ptr(it.current))->id);
-#  endif
-          exit(1);
-        }
-#endif
-        *(void **)field_iter.cur_field = new_addr + content_offset;
-      }
-    }
+    if (is_marked(get_object_content_ptr(it.current))) { fix_object_references(old_heap, it.current); }
     heap_next_obj_iterator(&it);
   }
-  // fix pointers from stack
-  scan_and_fix_region(old_heap, (void *)__gc_stack_top + sizeof(size_t), (void *)__gc_stack_bottom + sizeof(size_t));
+  // fix pointers from the stack and the global areas
+  const root_region *regions;
+  size_t             n = gc_root_regions(&regions);
+  for (size_t r = 0; r < n; ++r) { scan_and_fix_region(old_heap, regions[r].begin, regions[r].end); }
 
   // fix pointers from extra_roots
   scan_and_fix_region_roots(old_heap);
-
-#ifdef LAMA_ENV
-  assert((void *)&__stop_custom_data >= (void *)&__start_custom_data);
-  scan_and_fix_region(old_heap, (void *)&__start_custom_data, (void *)&__stop_custom_data);
-#endif
 #if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
   fprintf(stderr, "GC update_references finished\n");
 #endif
@@ -499,11 +769,53 @@ void physically_relocate (memory_chunk *old_heap) {
 }
 
 inline bool is_valid_heap_pointer (const size_t *p) {
-  return !UNBOXED(p) && (size_t)heap.begin <= (size_t)p && (size_t)p <= (size_t)heap.current;
+  return !UNBOXED(p)
+         && (((size_t)heap.begin <= (size_t)p && (size_t)p <= (size_t)heap.current) || los_contains(p));
 }
 
 static inline bool is_valid_pointer (const size_t *p) { return !UNBOXED(p); }
 
+void compressed_field_overflow (aint value) {
+  fprintf(stderr, "ERROR: value %" PRIdAI " does not fit a compressed field\n", value);
+  exit(1);
+}
+
+#ifdef LAMA_COMPACT_HEADERS
+// marked objects whose fields are still to be marked: objects have no word to thread
+// the queue through. Large objects are disabled with compact headers, see __init
+static void **mark_stack          = NULL;
+static size_t mark_stack_size     = 0;
+static size_t mark_stack_capacity = 0;
+
+static void mark_stack_push (void *obj) {
+  if (mark_stack_size == mark_stack_capacity) {
+    mark_stack_capacity = MAX(2 * mark_stack_capacity, 64);
+    mark_stack          = realloc(mark_stack, mark_stack_capacity * sizeof(void *));
+    if (mark_stack == NULL) {
+      perror("ERROR: mark_stack_push: realloc failed\n");
+      exit(1);
+    }
+  }
+  mark_stack[mark_stack_size++] = obj;
+}
+
+static void mark_heap_objects (void *obj) {
+  if (!is_valid_heap_pointer(obj) || is_marked(obj)) { return; }
+  mark_object(obj);
+  mark_stack_push(obj);
+  while (mark_stack_size > 0) {
+    void *cur_obj = mark_stack[--mark_stack_size];
+    for (obj_field_iterator ptr_field_it = ptr_field_begin_iterator(get_obj_header_ptr(cur_obj));
+         !field_is_done_iterator(&ptr_field_it);
+         obj_next_ptr_field_iterator(&ptr_field_it)) {
+      void *field_value = (void *)field_load(ptr_field_it.cur_field);
+      if (!is_valid_heap_pointer(field_value) || is_marked(field_value)) { continue; }
+      mark_object(field_value);
+      mark_stack_push(field_value);
+    }
+  }
+}
+#else
 static inline void queue_enqueue (heap_iterator *tail_iter, void *obj) {
   void *tail         = tail_iter->current;
   void *tail_content = get_object_content_ptr(tail);
@@ -521,8 +833,13 @@ static inline void *queue_dequeue (heap_iterator *head_iter) {
   return value;
 }
 
-void mark (void *obj) {
+// marks everything reachable from obj, stops at large objects which are left to the caller
+static void mark_heap_objects (void *obj) {
   if (!is_valid_heap_pointer(obj) || is_marked(obj)) { return; }
+  if (los_contains(obj)) {
+    los_mark(obj);
+    return;
+  }
 
   // TL;DR: [q_head_iter, q_tail_iter) q_head_iter -- current dequeue's victim, q_tail_iter -- place for next enqueue
   // in forward_address of corresponding element we store address of element to be removed after dequeue operation
@@ -541,17 +858,33 @@ void mark (void *obj) {
     for (obj_field_iterator ptr_field_it = ptr_field_begin_iterator(header_ptr);
          !field_is_done_iterator(&ptr_field_it);
          obj_next_ptr_field_iterator(&ptr_field_it)) {
-      void *field_value = *(void **)ptr_field_it.cur_field;
+      void *field_value = (void *)field_load(ptr_field_it.cur_field);
       if (!is_valid_heap_pointer(field_value) || is_marked(field_value)
           || is_enqueued(field_value)) {
         continue;
       }
+      if (los_contains(field_value)) {
+        los_mark(field_value);
+        continue;
+      }
       // if we came to this point it must be true that field_value is unmarked and not currently in queue
       // thus, we maintain the invariant
       queue_enqueue(&q_tail_iter, field_value);
     }
   }
 }
+#endif
+
+void mark (void *obj) {
+  mark_heap_objects(obj);
+  for (void *large; (large = los_next_grey()) != NULL;) {
+    for (obj_field_iterator it = ptr_field_begin_iterator(get_obj_header_ptr(large));
+         !field_is_done_iterator(&it);
+         obj_next_ptr_field_iterator(&it)) {
+      mark_heap_objects((void *)field_load(it.cur_field));
+    }
+  }
+}
 
 void scan_extra_roots (void) {
   for (int i = 0; i < extra_roots.current_free; ++i) {
@@ -586,26 +919,122 @@ void __gc_init (void) {
   __init();
 }
 
+static size_t env_size (const char *name, size_t default_value) {
+  const char *value = getenv(name);
+  if (value == NULL || *value == 0) { return default_value; }
+  char  *end;
+  size_t res = strtoull(value, &end, 10);
+  if (*end != 0) {
+    fprintf(stderr, "ERROR: %s: invalid value '%s'\n", name, value);
+    exit(1);
+  }
+  return res;
+}
+
+// returns index of the value of environment variable 'name' in 'options', the first option is the default
+static size_t env_choice (const char *name, const char *const *options, size_t options_number) {
+  const char *value = getenv(name);
+  if (value == NULL || *value == 0) { return 0; }
+  for (size_t i = 0; i < options_number; ++i) {
+    if (strcmp(value, options[i]) == 0) { return i; }
+  }
+  fprintf(stderr, "ERROR: %s: invalid value '%s'\n", name, value);
+  exit(1);
+}
+
 void __init (void) {
   signal(SIGSEGV, handler);
   size_t space_size = INIT_HEAP_SIZE * sizeof(size_t);
 
+  long cpus  = sysconf(_SC_NPROCESSORS_ONLN);
+  gc_threads = env_size("LAMA_GC_THREADS", cpus > 0 ? cpus : 1);
+  gc_threads = MAX(MIN(gc_threads, GC_MAX_THREADS), 1);
+
+  static const char *const modes[] = {"stw", "incremental", "concurrent"};
+  gc_mode            = (gc_mode_kind)env_choice("LAMA_GC_MODE", modes, sizeof(modes) / sizeof(modes[0]));
+  gc_pause_budget_us = env_size("LAMA_GC_PAUSE_BUDGET_US", GC_DEFAULT_PAUSE_BUDGET_US);
+
+  static const char *const collectors[] = {"lisp2", "immix", "semispace"};
+  gc_collector = (gc_collector_kind)env_choice("LAMA_GC", collectors, sizeof(collectors) / sizeof(collectors[0]));
+  if (gc_collector != GC_COLLECTOR_LISP2 && gc_mode != GC_MODE_STW) {
+    fprintf(stderr, "ERROR: LAMA_GC_MODE is supported only by lisp2 collector\n");
+    exit(1);
+  }
+  gc_los_enabled = gc_collector == GC_COLLECTOR_LISP2 && gc_mode == GC_MODE_STW;
+  static const char *const orders[] = {"sliding", "dfs"};
+  gc_compaction = (gc_compaction_kind)env_choice("LAMA_GC_COMPACTION", orders, sizeof(orders) / sizeof(orders[0]));
+#ifdef LAMA_COMPRESSED_REFS
+  if (gc_collector != GC_COLLECTOR_LISP2 || gc_compaction != GC_COMPACTION_SLIDING) {
+    fprintf(stderr, "ERROR: compressed references are supported only by lisp2 collector with sliding compaction\n");
+    exit(1);
+  }
+  // large objects are outside of the range offsets can address
+  gc_los_enabled = false;
+#endif
+#ifdef LAMA_COMPACT_HEADERS
+  if (gc_collector == GC_COLLECTOR_IMMIX || gc_mode != GC_MODE_STW) {
+    fprintf(stderr, "ERROR: compact headers are supported only by lisp2 collector in stw mode and semispace collector\n");
+    exit(1);
+  }
+  // marks and forwarding live in tables of the heap range, which only one thread writes
+  gc_threads     = 1;
+  gc_los_enabled = false;
+#endif
+
   srandom(time(NULL));
+  clear_extra_roots();
+  gc_stats_init();
+  gc_heap_dump_init();
+  if (gc_collector == GC_COLLECTOR_IMMIX) {
+    immix_init();
+    return;
+  }
+  if (gc_collector == GC_COLLECTOR_SEMISPACE) {
+    semispace_init();
+    return;
+  }
 
-  heap.begin = mmap(
-      NULL, space_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (gc_compaction == GC_COMPACTION_SLIDING) {
+    // sliding compaction works in place, so the heap never moves: its pages are committed on demand
+    heap.begin = mmap(NULL,
+                      WORDS_TO_BYTES(GC_HEAP_RESERVE_SIZE),
+                      PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                      -1,
+                      0);
+#ifdef MADV_HUGEPAGE
+    // transparent huge pages may be unavailable, the heap works without them
+    if (heap.begin != MAP_FAILED) { madvise(heap.begin, WORDS_TO_BYTES(GC_HEAP_RESERVE_SIZE), MADV_HUGEPAGE); }
+#endif
+  } else {
+    heap.begin = mmap(
+        NULL, space_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  }
   if (heap.begin == MAP_FAILED) {
     perror("ERROR: __init: mmap failed\n");
     exit(1);
   }
-  heap.end     = heap.begin + INIT_HEAP_SIZE;
-  heap.size    = INIT_HEAP_SIZE;
-  heap.current = heap.begin;
-  clear_extra_roots();
+#ifdef LAMA_COMPACT_HEADERS
+  if (mark_bitmap == NULL) {
+    mark_bitmap   = map_side_table();
+    block_offsets = map_side_table();
+  }
+#endif
+  heap.end       = heap.begin + INIT_HEAP_SIZE;
+  heap.size      = INIT_HEAP_SIZE;
+  heap.current   = heap.begin;
+  gc_alloc_limit = heap.end;
 }
 
 extern void __shutdown (void) {
-  munmap(heap.begin, heap.size);
+  if (gc_collector == GC_COLLECTOR_SEMISPACE) {
+    semispace_shutdown();
+  } else {
+    bool reserved = gc_collector == GC_COLLECTOR_LISP2 && gc_compaction == GC_COMPACTION_SLIDING;
+    munmap(heap.begin, WORDS_TO_BYTES(reserved ? GC_HEAP_RESERVE_SIZE : heap.size));
+  }
+  // nothing is marked now, so every large object is freed
+  los_sweep();
 #ifdef DEBUG_VERSION
   cur_id = 0;
 #endif
@@ -613,6 +1042,7 @@ extern void __shutdown (void) {
   heap.end          = NULL;
   heap.size         = 0;
   heap.current      = NULL;
+  gc_alloc_limit    = NULL;
   __gc_stack_top    = 0;
   __gc_stack_bottom = 0;
 }
@@ -674,8 +1104,9 @@ void dump_heap () {
       case CLOSURE: fprintf(stderr, "of kind CLOSURE\n"); break;
       case STRING: fprintf(stderr, "of kind STRING\n"); break;
       case SEXP:
-        fprintf(stderr, "of kind SEXP with tag %s\n", de_hash(TO_SEXP(content_ptr)->tag));
+        fprintf(stderr, "of kind SEXP with tag %s\n", de_hash(sexp_tag(content_ptr)));
         break;
+      case CONS: fprintf(stderr, "of kind CONS\n"); break;
     }
   }
 }
@@ -694,6 +1125,46 @@ void set_stack (size_t stack_top, size_t stack_bottom) {
 
 /* Utility functions */
 
+#ifdef LAMA_COMPACT_HEADERS
+size_t get_forward_address (void *obj) {
+  size_t i     = header_index(obj);
+  size_t below = mark_bitmap[i / WORD_BITS] & (((size_t)1 << (i % WORD_BITS)) - 1);
+  return (size_t)(heap.begin + block_offsets[i / WORD_BITS] + __builtin_popcountl(below));
+}
+
+void set_forward_address (void *obj, size_t addr) {
+  // forwarding is computed from mark_bitmap, only compute_locations can set it
+  fprintf(stderr, "ERROR: set_forward_address: objects have no forwarding word with compact headers\n");
+  exit(1);
+}
+
+bool is_marked (void *obj) {
+  size_t i = header_index(obj);
+  return (mark_bitmap[i / WORD_BITS] >> (i % WORD_BITS)) & 1;
+}
+
+void mark_object (void *obj) {
+  size_t from = header_index(obj);
+  size_t to   = from + BYTES_TO_WORDS(obj_size_header_ptr(TO_DATA(obj)));
+  while (from < to) {
+    size_t bit = from % WORD_BITS;
+    size_t n   = MIN(WORD_BITS - bit, to - from);
+    mark_bitmap[from / WORD_BITS] |= (n == WORD_BITS ? ~(size_t)0 : ((size_t)1 << n) - 1) << bit;
+    from += n;
+  }
+}
+
+// only sequential collectors run with compact headers, see __init
+bool try_mark_object (void *obj) {
+  if (is_marked(obj)) { return false; }
+  mark_object(obj);
+  return true;
+}
+
+// marks are dropped all at once by the next mark_phase: relocation still needs
+// the bits of objects it has moved to compute locations of the following ones
+void unmark_object (void *obj) { }
+#else
 size_t get_forward_address (void *obj) {
   data *d = TO_DATA(obj);
   return GET_FORWARD_ADDRESS(d->forward_address);
@@ -715,6 +1186,11 @@ void mark_object (void *obj) {
   SET_MARK_BIT(d->forward_address);
 }
 
+bool try_mark_object (void *obj) {
+  data *d = TO_DATA(obj);
+  return (__atomic_fetch_or(&d->forward_address, 1, __ATOMIC_RELAXED) & 1) == 0;
+}
+
 void unmark_object (void *obj) {
   data *d = TO_DATA(obj);
   RESET_MARK_BIT(d->forward_address);
@@ -735,6 +1211,8 @@ void make_dequeued (void *obj) {
   MAKE_DEQUEUED(d->forward_address);
 }
 
+#endif
+
 heap_iterator heap_begin_iterator () {
   heap_iterator it = {.current = heap.begin};
   return it;
@@ -762,6 +1240,7 @@ lama_type get_type_header_ptr (void *ptr) {
     case STRING_TAG: return STRING;
     case CLOSURE_TAG: return CLOSURE;
     case SEXP_TAG: return SEXP;
+    case CONS_TAG: return CONS;
     default: {
 #if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
       fprintf(stderr, "ERROR: get_type_header_ptr: unknown object header, cur_id=%d", cur_id);
@@ -800,7 +1279,8 @@ size_t obj_size_header_ptr (void *ptr) {
     case ARRAY: return array_size(len);
     case STRING: return string_size(len);
     case CLOSURE: return closure_size(len);
-    case SEXP: return sexp_size(len);
+    case SEXP:
+    case CONS: return sexp_size(len);
     default: {
 #ifdef DEBUG_VERSION
       fprintf(stderr, "ERROR: obj_size_header_ptr: unknown object header, cur_id=%d", cur_id);
@@ -822,7 +1302,7 @@ size_t string_size (size_t len) {
 
 size_t closure_size (size_t sz) { return get_header_size(CLOSURE) + MEMBER_SIZE * sz; }
 
-size_t sexp_size (size_t members) { return get_header_size(SEXP) + MEMBER_SIZE * (members + 1); }
+size_t sexp_size (size_t members) { return get_header_size(SEXP) + MEMBER_SIZE * members; }
 
 obj_field_iterator field_begin_iterator (void *obj) {
   lama_type          type = get_type_header_ptr(obj);
@@ -832,8 +1312,7 @@ obj_field_iterator field_begin_iterator (void *obj) {
       it.cur_field = get_end_of_obj(it.obj_ptr);
       break;
     }
-    case CLOSURE:
-    case SEXP: {
+    case CLOSURE: {
       it.cur_field += MEMBER_SIZE;
       break;
     }
@@ -846,7 +1325,7 @@ obj_field_iterator ptr_field_begin_iterator (void *obj) {
   obj_field_iterator it = field_begin_iterator(obj);
   // corner case when obj has no fields
   if (field_is_done_iterator(&it)) { return it; }
-  if (is_valid_pointer(*(size_t **)it.cur_field)) { return it; }
+  if (is_valid_pointer((size_t *)field_load(it.cur_field))) { return it; }
   obj_next_ptr_field_iterator(&it);
   return it;
 }
@@ -856,7 +1335,7 @@ void obj_next_field_iterator (obj_field_iterator *it) { it->cur_field += MEMBER_
 void obj_next_ptr_field_iterator (obj_field_iterator *it) {
   do {
     obj_next_field_iterator(it);
-  } while (!field_is_done_iterator(it) && !is_valid_pointer(*(size_t **)it->cur_field));
+  } while (!field_is_done_iterator(it) && !is_valid_pointer((size_t *)field_load(it->cur_field)));
 }
 
 bool field_is_done_iterator (obj_field_iterator *it) {
@@ -880,7 +1359,8 @@ size_t get_header_size (lama_type type) {
     case STRING:
     case CLOSURE:
     case ARRAY:
-    case SEXP: return DATA_HEADER_SZ;
+    case SEXP:
+    case CONS: return DATA_HEADER_SZ;
     default: perror("ERROR: get_header_size: unknown object type\n");
 #ifdef DEBUG_VERSION
       raise(SIGINT);   // only for debug purposes
@@ -892,13 +1372,16 @@ size_t get_header_size (lama_type type) {
 void *alloc_string (auint len) {
   data *obj        = alloc(string_size(len));
   obj->data_header = STRING_TAG | (len << 3);
+  obj->contents[len] = 0;
 #if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
   fprintf(stderr, "%p, [STRING] tag=%zu\n", obj, TAG(obj->data_header));
 #endif
 #ifdef DEBUG_VERSION
   obj->id = cur_id;
 #endif
+#ifndef LAMA_COMPACT_HEADERS
   obj->forward_address = 0;
+#endif
 #ifdef DEBUG_PRINT
   printf("Allocated string\n");
 #endif
@@ -914,7 +1397,9 @@ void *alloc_array (auint len) {
 #ifdef DEBUG_VERSION
   obj->id = cur_id;
 #endif
+#ifndef LAMA_COMPACT_HEADERS
   obj->forward_address = 0;
+#endif
 #ifdef DEBUG_PRINT
   printf("Allocated array\n");
 #endif
@@ -930,14 +1415,33 @@ void *alloc_sexp (auint members) {
 #ifdef DEBUG_VERSION
   obj->id = cur_id;
 #endif
+#ifndef LAMA_COMPACT_HEADERS
   obj->forward_address = 0;
-  obj->tag             = 0;
+#endif
 #ifdef DEBUG_PRINT
   printf("Allocated sexp\n");
 #endif
   return obj;
 }
 
+void *alloc_cons (void) {
+  sexp *obj        = alloc(sexp_size(2));
+  obj->data_header = CONS_HEADER;
+#if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
+  fprintf(stderr, "%p, CONS tag=%zu\n", obj, TAG(obj->data_header));
+#endif
+#ifdef DEBUG_VERSION
+  obj->id = cur_id;
+#endif
+#ifndef LAMA_COMPACT_HEADERS
+  obj->forward_address = 0;
+#endif
+#ifdef DEBUG_PRINT
+  printf("Allocated cons\n");
+#endif
+  return obj;
+}
+
 void *alloc_closure (auint captured) {
 
   data *obj        = alloc(closure_size(captured));
@@ -948,7 +1452,9 @@ void *alloc_closure (auint captured) {
 #ifdef DEBUG_VERSION
   obj->id = cur_id;
 #endif
+#ifndef LAMA_COMPACT_HEADERS
   obj->forward_address = 0;
+#endif
 #ifdef DEBUG_PRINT
   printf("Allocated closure\n");
 #endif
@@ -35,14 +35,33 @@
 #define GET_FORWARD_ADDRESS(x) (((ptrt)(x)) & (~3))
 // take the last two bits as they are and make all others zero
 #define SET_FORWARD_ADDRESS(x, addr) (x = ((x & 3) | ((ptrt)(addr))))
+#define WORD_BITS (sizeof(size_t) * 8)
 // if heap is full after gc shows in how many times it has to be extended
 #define EXTRA_ROOM_HEAP_COEFFICIENT 2
 #define MINIMUM_HEAP_CAPACITY (64)
+// heap shrinks to the size needed after GC_SHRINK_COLLECTIONS collections in a row
+// have needed less than 1 / GC_SHRINK_RATIO of it
+#ifndef GC_SHRINK_RATIO
+#  define GC_SHRINK_RATIO 4
+#endif
+#ifndef GC_SHRINK_COLLECTIONS
+#  define GC_SHRINK_COLLECTIONS 3
+#endif
+// with sliding compaction the heap lives in a range of GC_HEAP_RESERVE_SIZE
+// words reserved at startup, so it grows and shrinks without moving
+#ifndef GC_HEAP_RESERVE_SIZE
+#  ifdef LAMA_COMPRESSED_REFS
+// offsets of objects have to fit 32 bits
+#    define GC_HEAP_RESERVE_SIZE ((size_t)1 << 29)
+#  else
+#    define GC_HEAP_RESERVE_SIZE ((size_t)1 << 31)
+#  endif
+#endif
 
 #include <stdbool.h>
 #include <stddef.h>
 
-typedef enum { ARRAY, CLOSURE, STRING, SEXP } lama_type;
+typedef enum { ARRAY, CLOSURE, STRING, SEXP, CONS } lama_type;
 
 typedef struct {
   size_t *current;
@@ -81,10 +100,14 @@ void scan_global_area (void);
 #endif
 // takes number of words that are required to be allocated somewhere on the heap
 void compact_phase (size_t additional_size);
+// size of the heap after a collection which has found live_size words of live objects
+size_t next_heap_capacity (size_t live_size, size_t additional_size);
 // specific for Lisp-2 algorithm
 size_t compute_locations ();
 void   update_references (memory_chunk *);
 void   physically_relocate (memory_chunk *);
+// fixes every pointer field of a live object, header_ptr is pointer to the object header
+void   fix_object_references (memory_chunk *old_heap, void *header_ptr);
 
 // ============================================================================
 //                            GC extra roots
@@ -106,6 +129,459 @@ void clear_extra_roots (void);
 void push_extra_root (void **p);
 void pop_extra_root (void **p);
 
+extern memory_chunk     heap;
+extern extra_roots_pool extra_roots;
+
+// ============================================================================
+//                                 Fields
+// ============================================================================
+// Fields of arrays, s-expressions and closures have to be read and written with
+// field_load and field_store. With LAMA_COMPRESSED_REFS a field is 32-bit: it
+// keeps a boxed integer as it is and an object as its offset from heap.begin
+// (zero stays zero). Only lisp2 collector with sliding compaction supports it,
+// since the heap must not move and must fit GC_HEAP_RESERVE_SIZE.
+// The code pointer of a closure (its field 0) is not a Lama value and it is
+// accessed directly.
+// The concurrent marker reads fields while the interpreter writes them, so both
+// go through relaxed atomics; on x86-64 and AArch64 these are plain moves.
+
+// reports a value which cannot be stored in a compressed field
+_Noreturn void compressed_field_overflow (aint value);
+
+static inline aint field_load (const field_t *field) {
+#ifdef LAMA_COMPRESSED_REFS
+  field_t v = __atomic_load_n(field, __ATOMIC_RELAXED);
+  if (v & 1) { return (int32_t)v; }
+  return v == 0 ? 0 : (aint)((char *)heap.begin + v);
+#else
+  return __atomic_load_n(field, __ATOMIC_RELAXED);
+#endif
+}
+
+static inline void field_store (field_t *field, aint value) {
+#ifdef LAMA_COMPRESSED_REFS
+  if (value & 1) {
+    if ((int32_t)value != value) { compressed_field_overflow(value); }
+    __atomic_store_n(field, (field_t)value, __ATOMIC_RELAXED);
+  } else if (value == 0) {
+    __atomic_store_n(field, 0, __ATOMIC_RELAXED);
+  } else {
+    size_t offset = (size_t)((char *)value - (char *)heap.begin);
+    if (offset > UINT32_MAX) { compressed_field_overflow(value); }
+    __atomic_store_n(field, (field_t)offset, __ATOMIC_RELAXED);
+  }
+#else
+  __atomic_store_n(field, value, __ATOMIC_RELAXED);
+#endif
+}
+
+// contiguous area of words each of which may hold a Lama value (stack, global area)
+typedef struct {
+  size_t *begin;
+  size_t *end;
+} root_region;
+
+// the stack, the global area and the regions added by gc_register_root_region
+#define MAX_ROOT_REGIONS 4
+
+// sets '*regions' to every contiguous root area, returns their number; the array
+// stays valid until the next call. If gc_stack_roots is set, the stack is given
+// by the parts it reports instead of a single region
+size_t gc_root_regions (const root_region **regions);
+
+// adds [begin, end) to root areas scanned by GC besides the stack and the
+// global area of compiled code (the interpreter keeps its globals there)
+void gc_register_root_region (const char *name, size_t *begin, size_t *end);
+// name of the i-th region returned by gc_root_regions, every part of the stack is "stack"
+const char *gc_root_region_name (size_t i);
+// start of the root area the i-th region belongs to: the top of the stack for its parts
+size_t *gc_root_region_base (size_t i);
+
+// if set, is called by gc_root_regions and passes 'add' the parts of the stack
+// which may hold live values, so collectors do not scan the rest (the interpreter
+// skips frame bookkeeping and locals which are not read anymore, see stack maps
+// in main.c)
+extern void (*gc_stack_roots) (void (*add) (size_t *begin, size_t *end));
+
+// if set, is called by sliding compaction of lisp2 when live objects are marked
+// and their new locations are computed, but nothing has moved yet: lets the
+// embedder follow objects it does not keep alive (see allocation profiler in main.c)
+extern void (*gc_before_relocation) (void);
+
+// ============================================================================
+//                     Parallel marking and compaction
+// ============================================================================
+// On big heaps mark_phase is split between a pool of GC worker threads.
+// Roots (stack, extra roots and global area) are partitioned between workers,
+// every worker owns a Chase-Lev work-stealing deque of grey objects and steals
+// from the others once its own deque is drained. Mark-bit is set with an
+// atomic fetch-or, so every object is pushed to exactly one deque.
+// Compaction is split into GC_REGION_SIZE-word regions: regions are summarised
+// in parallel, a prefix sum over live sizes gives each region its destination,
+// then references are fixed and objects are moved region by region (see
+// gc_parallel.c for the order in which regions are allowed to move).
+// Number of workers is taken from LAMA_GC_THREADS (default is the number of
+// online CPUs), parallel GC is used only if heap is at least
+// GC_PARALLEL_MIN_HEAP_SIZE words big.
+#define GC_MAX_THREADS 64
+#ifndef GC_PARALLEL_MIN_HEAP_SIZE
+#  define GC_PARALLEL_MIN_HEAP_SIZE (1 << 20)
+#endif
+#ifndef GC_REGION_SIZE
+#  define GC_REGION_SIZE (1 << 15)
+#endif
+
+extern size_t gc_threads;
+
+typedef void (*gc_worker_job) (size_t worker_id, void *arg);
+
+// runs job on each of gc_threads workers (the caller is worker 0) and waits for all of them
+void gc_workers_run (gc_worker_job job, void *arg);
+bool gc_parallel_enabled (void);
+void parallel_mark_phase (void);
+// parallel counterparts of compute_locations, update_references and physically_relocate,
+// have to be preceded by parallel_mark_phase since they walk the bitmap of live objects it builds
+size_t parallel_compute_locations (void);
+void   parallel_update_references (memory_chunk *old_heap);
+void   parallel_physically_relocate (memory_chunk *old_heap);
+// atomically sets mark-bit, returns true if it was this call that has set it
+bool try_mark_object (void *obj);
+
+// ============================================================================
+//                          Incremental marking
+// ============================================================================
+// With LAMA_GC_MODE=incremental the collector does not stop the world for a
+// whole cycle. Once GC_INCREMENTAL_TRIGGER percent of the heap has been
+// allocated since the previous cycle, marking starts and then proceeds in
+// slices: every GC_INCREMENTAL_STEP allocated words the allocator falls into
+// the slow path (see gc_alloc_limit) and traces grey objects until the pause
+// budget (LAMA_GC_PAUSE_BUDGET_US) is spent.
+// Tri-colour invariant is kept by a Dijkstra insertion barrier: every value
+// stored into a heap object, closure or global is shaded while marking is
+// active. Stack and extra roots are not barriered, so the final pause rescans
+// them and drains what is left. Objects allocated during marking are white.
+// After marking the heap is compacted only if the dead part of it is at least
+// GC_FRAGMENTATION_THRESHOLD percent, otherwise dead objects are swept (again
+// in budgeted slices) into segregated free lists and reused in place.
+// If neither bump pointer nor free lists can satisfy an allocation the current
+// cycle is finished in one pause and the heap is compacted (and extended).
+typedef enum { GC_MODE_STW, GC_MODE_INCREMENTAL, GC_MODE_CONCURRENT } gc_mode_kind;
+
+#ifndef GC_INCREMENTAL_TRIGGER
+#  define GC_INCREMENTAL_TRIGGER 50
+#endif
+#ifndef GC_INCREMENTAL_STEP
+#  define GC_INCREMENTAL_STEP (1 << 12)
+#endif
+#ifndef GC_FRAGMENTATION_THRESHOLD
+#  define GC_FRAGMENTATION_THRESHOLD 30
+#endif
+#define GC_DEFAULT_PAUSE_BUDGET_US 1000
+// free lists for chunks of exactly 0..GC_FREE_LIST_CLASSES-2 words, the last one keeps all bigger chunks
+#define GC_FREE_LIST_CLASSES 64
+
+extern gc_mode_kind gc_mode;
+extern size_t       gc_pause_budget_us;
+// bump allocation on the existing heap succeeds only below this bound; it is
+// heap.end unless incremental GC wants to get control earlier
+extern size_t      *gc_alloc_limit;
+extern bool         gc_marking_active;
+
+// makes obj grey unless it is already grey or black
+void gc_shade (void *obj);
+// slow path of allocation in the incremental mode
+void *incremental_alloc (size_t size);
+
+// ============================================================================
+//                           Concurrent marking
+// ============================================================================
+// With LAMA_GC_MODE=concurrent marking is done by a dedicated background
+// thread while the interpreter keeps running. A cycle is triggered the same
+// way as in the incremental mode and starts with a pause which shades roots.
+// Objects reachable at that moment are preserved by a snapshot-at-the-beginning
+// barrier: the value being overwritten is marked and handed to the marker.
+// Objects allocated during marking lie above the top-at-mark-start and are
+// implicitly live. Once the marker runs out of work, the final pause rescans
+// the stack and extra roots, marks objects allocated during the cycle, traces
+// what is left and compacts the heap.
+// Memory model: the marker and the interpreter access the same fields only
+// through field_load/field_store (relaxed atomics) and set mark bits with an
+// atomic or (try_mark_object), so there is no data race. No stronger ordering
+// is needed: if the marker reads the new value of a field, the old one has been
+// recorded by the barrier before the store and reaches the marker through
+// marker_lock or in the final pause. Headers of objects in the snapshot are not
+// written by the interpreter; objects allocated during marking are never traced
+// by the marker.
+// size of the mutator's buffer of recorded old values, it is passed to the marker when full
+#ifndef GC_SATB_BUFFER_SIZE
+#  define GC_SATB_BUFFER_SIZE 256
+#endif
+
+// records a value overwritten during concurrent marking
+void  gc_satb_record (void *old_value);
+// slow path of allocation in the concurrent mode
+void *concurrent_alloc (size_t size);
+
+// has to be called whenever 'value' overwrites 'old_value' in a field of a heap
+// object, closure or in a global variable
+static inline void gc_write_barrier (void *old_value, void *value) {
+  if (gc_marking_active) {
+    if (gc_mode == GC_MODE_CONCURRENT) {
+      gc_satb_record(old_value);
+    } else {
+      gc_shade(value);
+    }
+  }
+}
+
+// ============================================================================
+//                               Collectors
+// ============================================================================
+// LAMA_GC selects the collector at startup: 'lisp2' (default) is the
+// compacting collector described at the top of this file.
+typedef enum { GC_COLLECTOR_LISP2, GC_COLLECTOR_IMMIX, GC_COLLECTOR_SEMISPACE } gc_collector_kind;
+
+extern gc_collector_kind gc_collector;
+
+// ============================================================================
+//                           Immix (LAMA_GC=immix)
+// ============================================================================
+// Mark-region collector. Heap is a reserved range of GC_IMMIX_RESERVE_SIZE
+// words, which is split into blocks of GC_IMMIX_BLOCK_SIZE words, and each
+// block into lines of GC_IMMIX_LINE_SIZE words. Blocks are taken (and
+// therefore committed) on demand, so growing the heap copies nothing; heap.current
+// is the end of the highest block in use.
+// Marking also marks every line a live object occupies; the sweep classifies
+// blocks as free (their memory is released), full or recyclable. Allocation
+// bumps through holes (runs of free lines) of recyclable blocks and then
+// through free blocks; medium objects which do not fit the current hole go to
+// a separate overflow block, objects bigger than a block take several blocks.
+// A collection starts once allocated blocks exceed the budget, which is
+// EXTRA_ROOM_HEAP_COEFFICIENT times the blocks surviving the last collection.
+// Up to GC_IMMIX_DEFRAG_PERCENT percent of blocks, the most fragmented ones,
+// are evacuated during marking: their survivors are copied to free blocks and
+// references to them are updated when traced.
+#define GC_IMMIX_BLOCK_SIZE 4096
+#define GC_IMMIX_LINE_SIZE 16
+#ifndef GC_IMMIX_RESERVE_SIZE
+#  define GC_IMMIX_RESERVE_SIZE ((size_t)1 << 31)
+#endif
+#define GC_IMMIX_MIN_BLOCKS 4
+#ifndef GC_IMMIX_DEFRAG_PERCENT
+#  define GC_IMMIX_DEFRAG_PERCENT 10
+#endif
+#ifndef GC_IMMIX_DEFRAG_MIN_HOLES
+#  define GC_IMMIX_DEFRAG_MIN_HOLES 4
+#endif
+
+void  immix_init (void);
+void  immix_collect (void);
+void *immix_alloc (size_t size);
+
+// ============================================================================
+//                       Semispace (LAMA_GC=semispace)
+// ============================================================================
+// Cheney copying collector: survivors are copied breadth-first from the roots
+// into a fresh to-space, which then becomes the heap; dead objects are never
+// visited. Heap sizing is the same as in compact_phase.
+void semispace_init (void);
+void semispace_shutdown (void);
+void semispace_collect (size_t additional_size);
+
+// ============================================================================
+//                 Depth-first compaction (LAMA_GC_COMPACTION=dfs)
+// ============================================================================
+// Sliding compaction keeps allocation order. In 'dfs' order compact_phase
+// copies live objects into the new heap in depth-first order from the roots
+// instead, so every object is followed by its first unvisited child: list
+// cells end up next to their tails. It is sequential, marking included.
+typedef enum { GC_COMPACTION_SLIDING, GC_COMPACTION_DFS } gc_compaction_kind;
+
+extern gc_compaction_kind gc_compaction;
+
+void dfs_compact_phase (size_t additional_size);
+
+// ============================================================================
+//                            Large object space
+// ============================================================================
+// With lisp2 collector in stw mode objects of at least GC_LARGE_OBJECT_SIZE
+// words are allocated with their own mmap outside the heap. They are marked
+// together with the heap and their fields are updated by compaction, but they
+// are never moved; dead ones are unmapped by los_sweep. Allocation of large
+// objects triggers a collection once it exceeds the size of the heap (or of
+// large objects which have survived, whichever is bigger).
+#ifndef GC_LARGE_OBJECT_SIZE
+#  define GC_LARGE_OBJECT_SIZE (1 << 13)
+#endif
+
+extern bool gc_los_enabled;
+
+void *los_alloc (size_t size);
+// is p the content pointer of a large object
+bool  los_contains (const void *p);
+// sets mark-bit of a large object, its fields are left for the caller: see los_next_grey
+void  los_mark (void *obj);
+// returns the next object marked by los_mark whose fields are not marked yet, or NULL
+void *los_next_grey (void);
+void  los_for_each_live (void (*f) (size_t *header));
+void  los_for_each (void (*f) (size_t *header));
+void  los_fix_references (memory_chunk *old_heap);
+// unmaps unmarked large objects and unmarks the rest
+void  los_sweep (void);
+// words of large objects which have not been swept yet
+size_t los_words (void);
+
+// ============================================================================
+//                                Safepoints
+// ============================================================================
+// With lisp2 collector in stw mode and sliding compaction the embedder may ask
+// GC to collect only at safepoints (see gc_enable_safepoints). Then allocation
+// never collects: when the heap is exhausted it is extended in its reservation
+// by at least GC_SAFEPOINT_RESERVE words and a collection is requested (large
+// objects request it the same way). The collection happens in gc_safepoint,
+// which the embedder calls where all roots are on the stack or in root regions,
+// so runtime functions are never interrupted by GC in the middle.
+#ifndef GC_SAFEPOINT_RESERVE
+#  define GC_SAFEPOINT_RESERVE (1 << 16)
+#endif
+
+extern bool          gc_safepoints_enabled;
+// is also set by signal handlers (see heap dumps), so it is volatile
+extern volatile bool gc_requested;
+
+// switches GC to safepoints if the collector supports them, returns whether it has
+bool gc_enable_safepoints (void);
+void gc_collect_at_safepoint (void);
+// stop-the-world cycle of lisp2 collector
+void gc_collect (size_t additional_size);
+
+static inline void gc_safepoint (void) {
+  if (gc_requested) { gc_collect_at_safepoint(); }
+}
+
+// ============================================================================
+//                                Heap dump
+// ============================================================================
+// With LAMA_HEAP_DUMP=<path> (lisp2 collector in stw mode only) the live heap
+// is written to <path> when the embedder calls gc_heap_dump_at_exit, and to
+// <path>.<n> on the n-th SIGUSR1; the signal only requests the dump, it is
+// written by the next gc_safepoint. Every dump starts with a collection, so
+// all objects in it are reachable. See heap_analyser.c for the reader.
+//
+// Format: HEAP_DUMP_MAGIC, then records, each starts with a record kind byte.
+// Numbers are unsigned LEB128, addresses are those of object contents.
+//   HEAP_DUMP_REGION: index, name length, name  -- root region, see gc_root_regions
+//   HEAP_DUMP_TAG:    hash, name length, name   -- before the first sexp with the tag
+//   HEAP_DUMP_OBJECT: address, lama_type, tag hash (0 if not a sexp), length,
+//                     size in bytes, references number, referenced addresses
+//   HEAP_DUMP_ROOT:   region index, slot index (see gc_root_region_base), address
+//   HEAP_DUMP_END
+#define HEAP_DUMP_MAGIC "LAMAHEAP1"
+
+enum { HEAP_DUMP_END, HEAP_DUMP_REGION, HEAP_DUMP_TAG, HEAP_DUMP_OBJECT, HEAP_DUMP_ROOT };
+
+// installs SIGUSR1 handler if LAMA_HEAP_DUMP is set
+void gc_heap_dump_init (void);
+bool gc_heap_dump_pending (void);
+// collects and writes the heap to 'path'
+void gc_heap_dump (const char *path);
+void gc_heap_dump_at_safepoint (void);
+void gc_heap_dump_at_exit (void);
+
+// ============================================================================
+//                                Telemetry
+// ============================================================================
+// Enabled by LAMA_GC_STATS: 'summary' prints a summary to stderr at exit, any
+// other value is the name of a file the statistics are written to as JSON.
+// Every cycle is recorded with its pauses, heap occupancy before and after it
+// and the new heap size. A stop-the-world cycle is a single pause; a cycle of
+// incremental or concurrent mode spans several pauses (marking and sweeping
+// slices, the initial and the final pause), each of them goes to the pause
+// histogram. lisp2 cycles also have timings of their phases (sliding
+// compaction only, dfs compaction is a single pass; in incremental and
+// concurrent modes only the marking of the final pause is timed). Bytes allocated between cycles are
+// derived from occupancy, so an object dead before a cycle counts as allocated.
+typedef enum {
+  GC_PHASE_MARK,
+  GC_PHASE_COMPUTE_LOCATIONS,
+  GC_PHASE_UPDATE_REFERENCES,
+  GC_PHASE_PHYSICALLY_RELOCATE,
+  GC_PHASES
+} gc_phase;
+
+// pauses are counted in buckets [2^(i-1), 2^i) microseconds, the last one is unbounded
+#define GC_STATS_PAUSE_BUCKETS 24
+
+extern bool gc_stats_enabled;
+
+void     gc_stats_init (void);
+// 'used_words' are occupied by objects (live or not) when the cycle starts; a
+// cycle starts with a pause and ends the current pause, if any
+void     gc_stats_cycle_begin (size_t used_words);
+void     gc_stats_cycle_end (size_t live_words, size_t heap_words);
+// a pause within a cycle, nested calls are ignored
+void     gc_stats_pause_begin (void);
+void     gc_stats_pause_end (void);
+// returns the current time in nanoseconds, or 0 outside of a recorded cycle
+uint64_t gc_stats_now (void);
+void     gc_stats_phase (gc_phase phase, uint64_t since);
+
+// ============================================================================
+//                             Inline allocation
+// ============================================================================
+// Allocated memory is not zeroed: every alloc_* caller fills the whole object
+// before the next allocation. gc_alloc_inline is the fast path of alloc for an
+// object of 'bytes' bytes with the given header, it returns NULL when the slow
+// path is needed (the bump region is exhausted or the object is large).
+// gc_alloc_fields_inline allocates arrays, s-expressions and closures with
+// 'fields' fields, gc_alloc_string_inline strings with their terminating zero;
+// the caller has to fill fields or characters.
+static inline data *gc_alloc_inline (auint header, size_t bytes) {
+#ifdef DEBUG_VERSION
+  // objects get their ids in alloc
+  return NULL;
+#else
+  size_t words = BYTES_TO_WORDS(bytes);
+  if (heap.current + words > gc_alloc_limit || (gc_los_enabled && words >= GC_LARGE_OBJECT_SIZE)) {
+    return NULL;
+  }
+  data *d = (data *)heap.current;
+  heap.current += words;
+  d->data_header = header;
+#ifndef LAMA_COMPACT_HEADERS
+  d->forward_address = 0;
+#endif
+  return d;
+#endif
+}
+
+static inline data *gc_alloc_fields_inline (auint header, size_t fields) {
+  return gc_alloc_inline(header, DATA_HEADER_SZ + MEMBER_SIZE * fields);
+}
+
+static inline data *gc_alloc_string_inline (auint len) {
+  data *d = gc_alloc_inline(STRING_TAG | (len << 3), DATA_HEADER_SZ + len + 1);
+  if (d != NULL) { d->contents[len] = 0; }
+  return d;
+}
+
+// ============================================================================
+//                             Permanent objects
+// ============================================================================
+// Objects without references (s-expressions without fields, closures without
+// captured values) may be shared by every evaluation which builds them. They
+// are allocated once by alloc_permanent outside of the heap and live until the
+// exit: collectors ignore pointers outside of the heap, so such objects are
+// never marked, moved or freed. A permanent object must never get a reference
+// to a heap object. alloc_permanent returns zeroed memory, or NULL with
+// LAMA_COMPRESSED_REFS, where fields can address only the heap.
+#ifndef GC_PERMANENT_CHUNK_SIZE
+#  define GC_PERMANENT_CHUNK_SIZE (1 << 12)
+#endif
+
+void *alloc_permanent (size_t bytes);
+bool  is_permanent_pointer (const void *p);
+
 // ============================================================================
 //                   Implemented in GASM: see gc_runtime.s
 // ============================================================================
@@ -128,6 +604,11 @@ extern void        gc_test_and_mark_root (size_t **root);
 bool               is_valid_heap_pointer (const size_t *);
 static inline bool is_valid_pointer (const size_t *);
 
+// whether p is a heap object or a permanent one, see alloc_permanent
+static inline bool is_object_pointer (const void *p) {
+  return is_valid_heap_pointer(p) || (!UNBOXED(p) && is_permanent_pointer(p));
+}
+
 // ============================================================================
 //                     Auxiliary functions for tests
 // ============================================================================
@@ -153,6 +634,8 @@ void set_stack (size_t stack_top, size_t stack_bottom);
 // accepts pointer to the start of the region and to the end of the region
 // scans it and if it meets a pointer, it should be modified in according to forward address
 void scan_and_fix_region (memory_chunk *old_heap, void *start, void *end);
+// same as scan_and_fix_region for every extra root that is not on the stack or in the global area
+void scan_and_fix_region_roots (memory_chunk *old_heap);
 
 // takes a pointer to an object content as an argument, returns forwarding address
 size_t get_forward_address (void *obj);
@@ -169,6 +652,7 @@ void mark_object (void *obj);
 // takes a pointer to an object content as an argument, marks the object as dead
 void unmark_object (void *obj);
 
+#ifndef LAMA_COMPACT_HEADERS
 // takes a pointer to an object content as an argument, returns whether this object was enqueued to the queue (which is used in mark phase)
 bool is_enqueued (void *obj);
 
@@ -177,6 +661,7 @@ void make_enqueued (void *obj);
 
 // takes a pointer to an object content as an argument, unmarks object as enqueued
 void make_dequeued (void *obj);
+#endif
 
 // returns iterator to an object with the lowest address
 heap_iterator heap_begin_iterator ();
@@ -232,9 +717,43 @@ void *get_obj_header_ptr (void *ptr);
 void *get_object_content_ptr (void *header_ptr);
 void *get_end_of_obj (void *header_ptr);
 
+// Copying collectors (semispace, dfs, evacuation of immix) leave the new location of
+// an object in its old copy: in forward_address flagged with the enqueued-bit or, with
+// compact headers, in place of data_header, whose tag is never zero.
+static inline bool is_forwarded (void *obj) {
+#ifdef LAMA_COMPACT_HEADERS
+  return TAG(TO_DATA(obj)->data_header) == 0;
+#else
+  return IS_ENQUEUED(TO_DATA(obj)->forward_address) != 0;
+#endif
+}
+
+// header of the new copy of a forwarded object
+static inline size_t *forwarded_to (void *obj) {
+#ifdef LAMA_COMPACT_HEADERS
+  return (size_t *)TO_DATA(obj)->data_header;
+#else
+  return (size_t *)GET_FORWARD_ADDRESS(TO_DATA(obj)->forward_address);
+#endif
+}
+
+// records that obj has been copied to the header 'to', the copy is neither marked nor forwarded
+static inline void forward_to (void *obj, size_t *to) {
+#ifdef LAMA_COMPACT_HEADERS
+  TO_DATA(obj)->data_header = (auint)to;
+#else
+  TO_DATA(get_object_content_ptr(to))->forward_address = 0;
+  data *d            = TO_DATA(obj);
+  d->forward_address = (ptrt)to;
+  MAKE_ENQUEUED(d->forward_address);
+#endif
+}
+
 void *alloc_string (auint len);
 void *alloc_array (auint len);
 void *alloc_sexp (auint members);
+// allocates a cons cell, an s-expression "cons" with two fields
+void *alloc_cons (void);
 void *alloc_closure (auint captured);
 
 #endif
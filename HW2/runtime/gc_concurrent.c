@@ -0,0 +1,225 @@
+#define _GNU_SOURCE 1
+
+#include "gc.h"
+
+#include "runtime_common.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum { IDLE, MARKING } cycle_state;
+
+static cycle_state state = IDLE;
+// words allocated since the end of the previous cycle
+static size_t      allocated_words = 0;
+// heap.current at the moment the slow path has been left last time
+static size_t     *last_current    = NULL;
+// top at mark start: everything above it is allocated during marking and is live
+static size_t     *tams            = NULL;
+
+// ============================================================================
+//                               Grey objects
+// ============================================================================
+// 'grey' is owned by the marker while it is busy and by the mutator in pauses.
+// Values recorded by the barrier are already marked, the mutator collects them
+// in 'satb_buffer' and hands them over to the marker through 'satb_queue'.
+
+typedef struct {
+  void **items;
+  size_t size;
+  size_t capacity;
+} object_stack;
+
+static object_stack grey;
+static object_stack satb_queue;   // guarded by marker_lock
+static void        *satb_buffer[GC_SATB_BUFFER_SIZE];
+static size_t       satb_buffer_size = 0;
+
+static void object_stack_push (object_stack *s, void *obj) {
+  if (s->size == s->capacity) {
+    s->capacity = MAX(2 * s->capacity, 1024);
+    s->items    = realloc(s->items, s->capacity * sizeof(void *));
+    if (s->items == NULL) {
+      perror("ERROR: object_stack_push: realloc failed\n");
+      exit(1);
+    }
+  }
+  s->items[s->size++] = obj;
+}
+
+// moves the content of 'from' to 'to'
+static void object_stack_move (object_stack *to, object_stack *from) {
+  for (size_t i = 0; i < from->size; ++i) { object_stack_push(to, from->items[i]); }
+  from->size = 0;
+}
+
+// pointers to objects allocated during marking are filtered out, since those are always live
+static inline bool in_snapshot (void *p) {
+  return !UNBOXED(p) && (size_t *)p > heap.begin && (size_t *)p <= tams;
+}
+
+static inline void shade (void *obj) {
+  if (in_snapshot(obj) && try_mark_object(obj)) { object_stack_push(&grey, obj); }
+}
+
+static void drain_grey (void) {
+  while (grey.size > 0) {
+    void *obj = grey.items[--grey.size];
+    for (obj_field_iterator it = ptr_field_begin_iterator(get_obj_header_ptr(obj));
+         !field_is_done_iterator(&it);
+         obj_next_ptr_field_iterator(&it)) {
+      shade((void *)field_load(it.cur_field));
+    }
+  }
+}
+
+// ============================================================================
+//                              Marker thread
+// ============================================================================
+
+static pthread_t       marker;
+static bool            marker_started = false;
+static bool            marker_busy    = false;   // guarded by marker_lock
+static pthread_mutex_t marker_lock    = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  marker_wakeup  = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  marker_idle    = PTHREAD_COND_INITIALIZER;
+
+static void *marker_loop (void *arg) {
+  pthread_mutex_lock(&marker_lock);
+  while (true) {
+    while (!marker_busy) { pthread_cond_wait(&marker_wakeup, &marker_lock); }
+    do {
+      object_stack_move(&grey, &satb_queue);
+      pthread_mutex_unlock(&marker_lock);
+      drain_grey();
+      pthread_mutex_lock(&marker_lock);
+    } while (satb_queue.size > 0);
+    marker_busy = false;
+    pthread_cond_signal(&marker_idle);
+  }
+  return NULL;
+}
+
+// wakes the marker up, it will trace everything from 'grey' and 'satb_queue'
+static void marker_start_locked (void) {
+  if (!marker_started) {
+    if (pthread_create(&marker, NULL, marker_loop, NULL) != 0) {
+      perror("ERROR: marker_start: pthread_create failed\n");
+      exit(1);
+    }
+    pthread_detach(marker);
+    marker_started = true;
+  }
+  marker_busy = true;
+  pthread_cond_signal(&marker_wakeup);
+}
+
+static bool marker_is_idle (void) {
+  pthread_mutex_lock(&marker_lock);
+  bool idle = !marker_busy;
+  pthread_mutex_unlock(&marker_lock);
+  return idle;
+}
+
+static void wait_for_marker (void) {
+  pthread_mutex_lock(&marker_lock);
+  while (marker_busy) { pthread_cond_wait(&marker_idle, &marker_lock); }
+  pthread_mutex_unlock(&marker_lock);
+}
+
+static void satb_flush (void) {
+  pthread_mutex_lock(&marker_lock);
+  for (size_t i = 0; i < satb_buffer_size; ++i) { object_stack_push(&satb_queue, satb_buffer[i]); }
+  satb_buffer_size = 0;
+  if (!marker_busy) { marker_start_locked(); }
+  pthread_mutex_unlock(&marker_lock);
+}
+
+void gc_satb_record (void *old_value) {
+  if (!in_snapshot(old_value) || !try_mark_object(old_value)) { return; }
+  satb_buffer[satb_buffer_size++] = old_value;
+  if (satb_buffer_size == GC_SATB_BUFFER_SIZE) { satb_flush(); }
+}
+
+// ============================================================================
+//                                 Pauses
+// ============================================================================
+
+static void shade_roots (void) {
+  const root_region *regions;
+  size_t             n = gc_root_regions(&regions);
+  for (size_t r = 0; r < n; ++r) {
+    for (size_t *p = regions[r].begin; p < regions[r].end; ++p) { shade(*(void **)p); }
+  }
+  for (int i = 0; i < extra_roots.current_free; ++i) { shade(*extra_roots.roots[i]); }
+}
+
+// the initial pause
+static void start_marking (void) {
+  gc_stats_cycle_begin(heap.current - heap.begin);
+  state             = MARKING;
+  tams              = heap.current;
+  gc_marking_active = true;
+  shade_roots();
+
+  pthread_mutex_lock(&marker_lock);
+  marker_start_locked();
+  pthread_mutex_unlock(&marker_lock);
+  gc_stats_pause_end();
+}
+
+// the final pause, it waits for the marker if it is still busy
+static void finish_marking (size_t additional_size) {
+  gc_stats_pause_begin();
+  wait_for_marker();
+  // the marker is asleep now, so its structures belong to the mutator
+  object_stack_move(&grey, &satb_queue);
+  for (size_t i = 0; i < satb_buffer_size; ++i) { object_stack_push(&grey, satb_buffer[i]); }
+  satb_buffer_size = 0;
+
+  uint64_t t = gc_stats_now();
+  shade_roots();
+  for (size_t *p = tams; p < heap.current; p += BYTES_TO_WORDS(obj_size_header_ptr(p))) {
+    mark_object(get_object_content_ptr(p));
+  }
+  drain_grey();
+  gc_marking_active = false;
+  gc_stats_phase(GC_PHASE_MARK, t);
+
+  compact_phase(additional_size);
+  state           = IDLE;
+  allocated_words = 0;
+  gc_stats_cycle_end(heap.current - heap.begin, heap.size);
+}
+
+// ============================================================================
+//                               Allocation
+// ============================================================================
+
+void *concurrent_alloc (size_t size) {
+  if (last_current != NULL && heap.current >= last_current) {
+    allocated_words += heap.current - last_current;
+  }
+  gc_alloc_limit = heap.end;
+
+  if (state == IDLE && allocated_words * 100 >= heap.size * GC_INCREMENTAL_TRIGGER) {
+    start_marking();
+  } else if (state == MARKING && marker_is_idle()) {
+    finish_marking(size);
+  }
+
+  void *p = gc_alloc_on_existing_heap(size);
+  if (p == NULL) {
+    // the heap is exhausted before the marker has finished, so wait for it
+    if (state == IDLE) { start_marking(); }
+    finish_marking(size);
+    p = gc_alloc_on_existing_heap(size);
+  }
+  allocated_words += size;
+
+  last_current   = heap.current;
+  gc_alloc_limit = MIN(heap.end, heap.current + GC_INCREMENTAL_STEP);
+  return p;
+}
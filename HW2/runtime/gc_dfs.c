@@ -0,0 +1,109 @@
+#define _GNU_SOURCE 1
+
+#include "gc.h"
+
+#include "runtime_common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// slots which are still to be forwarded, the top one is processed first
+static void ***slots          = NULL;
+static size_t  slots_size     = 0;
+static size_t  slots_capacity = 0;
+
+static void slots_push (void **slot) {
+  if (slots_size == slots_capacity) {
+    slots_capacity = MAX(2 * slots_capacity, 1024);
+    slots          = realloc(slots, slots_capacity * sizeof(void **));
+    if (slots == NULL) {
+      perror("ERROR: slots_push: realloc failed\n");
+      exit(1);
+    }
+  }
+  slots[slots_size++] = slot;
+}
+
+static memory_chunk old_heap;
+static size_t      *free_ptr;
+
+static inline bool in_old_heap (void *p) {
+  return !UNBOXED(p) && (size_t *)p > old_heap.begin && (size_t *)p <= old_heap.current;
+}
+
+// copies everything reachable from root which has not been copied yet, an object is
+// copied right before its fields are visited; copied objects of the old heap are
+// forwarded to their new location, see forward_to
+static void copy_reachable (void **root) {
+  slots_push(root);
+  while (slots_size > 0) {
+    void **slot = slots[--slots_size];
+    void  *obj  = *slot;
+    if (!in_old_heap(obj)) { continue; }
+    if (!is_forwarded(obj)) {
+      size_t *header = get_obj_header_ptr(obj);
+      size_t  words  = BYTES_TO_WORDS(obj_size_header_ptr(header));
+      memcpy(free_ptr, header, WORDS_TO_BYTES(words));
+      forward_to(obj, free_ptr);
+
+      // fields are pushed in reverse, so that the first one is visited first
+      size_t first = slots_size;
+      for (obj_field_iterator it = ptr_field_begin_iterator(free_ptr); !field_is_done_iterator(&it);
+           obj_next_ptr_field_iterator(&it)) {
+        if (in_old_heap(*(void **)it.cur_field)) { slots_push((void **)it.cur_field); }
+      }
+      for (size_t i = first, j = slots_size; i + 1 < j; ++i, --j) {
+        void **tmp   = slots[i];
+        slots[i]     = slots[j - 1];
+        slots[j - 1] = tmp;
+      }
+      free_ptr += words;
+    }
+    *slot = get_object_content_ptr(forwarded_to(obj));
+  }
+}
+
+static void copy_fields_reachable (size_t *header) {
+  for (obj_field_iterator it = ptr_field_begin_iterator(header); !field_is_done_iterator(&it);
+       obj_next_ptr_field_iterator(&it)) {
+    copy_reachable((void **)it.cur_field);
+  }
+}
+
+void dfs_compact_phase (size_t additional_size) {
+  size_t live_size = 0;
+  for (size_t *p = heap.begin; p < heap.current; p += BYTES_TO_WORDS(obj_size_header_ptr(p))) {
+    if (is_marked(get_object_content_ptr(p))) { live_size += BYTES_TO_WORDS(obj_size_header_ptr(p)); }
+  }
+
+  // all in words
+  size_t next_heap_size = next_heap_capacity(live_size, additional_size);
+
+  old_heap   = heap;
+  heap.begin = mmap(NULL, WORDS_TO_BYTES(next_heap_size), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (heap.begin == MAP_FAILED) {
+    perror("ERROR: dfs_compact_phase: mmap failed\n");
+    exit(1);
+  }
+  free_ptr = heap.begin;
+
+  const root_region *regions;
+  size_t             n = gc_root_regions(&regions);
+  for (size_t r = 0; r < n; ++r) {
+    for (size_t *p = regions[r].begin; p < regions[r].end; ++p) { copy_reachable((void **)p); }
+  }
+  for (int i = 0; i < extra_roots.current_free; ++i) { copy_reachable(extra_roots.roots[i]); }
+  los_for_each_live(copy_fields_reachable);
+
+  heap.end       = heap.begin + next_heap_size;
+  heap.size      = next_heap_size;
+  heap.current   = free_ptr;
+  gc_alloc_limit = heap.end;
+  if (munmap(old_heap.begin, WORDS_TO_BYTES(old_heap.size)) < 0) {
+    perror("ERROR: dfs_compact_phase: munmap failed\n");
+    exit(1);
+  }
+  los_sweep();
+}
@@ -0,0 +1,154 @@
+#define _GNU_SOURCE 1
+
+#include "gc.h"
+
+#include "runtime_common.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern char *de_hash (aint);
+
+// NULL if dumps are disabled
+static const char           *dump_path = NULL;
+static volatile sig_atomic_t signal_dumps_requested = 0;
+static size_t                signal_dumps_written   = 0;
+
+static void request_dump (int sig) {
+  ++signal_dumps_requested;
+  gc_requested = true;
+}
+
+void gc_heap_dump_init (void) {
+  const char *value = getenv("LAMA_HEAP_DUMP");
+  if (value == NULL || *value == 0) { return; }
+  if (gc_collector != GC_COLLECTOR_LISP2 || gc_mode != GC_MODE_STW) {
+    fprintf(stderr, "ERROR: LAMA_HEAP_DUMP is supported only by lisp2 collector in stw mode\n");
+    exit(1);
+  }
+  dump_path = value;
+  signal(SIGUSR1, request_dump);
+}
+
+bool gc_heap_dump_pending (void) { return signal_dumps_written < (size_t)signal_dumps_requested; }
+
+// ============================================================================
+//                                 Writing
+// ============================================================================
+
+static FILE *out;
+
+// hashes of tags written so far
+static aint  *tags           = NULL;
+static size_t tags_number    = 0;
+static size_t tags_capacity  = 0;
+
+static void put_number (uint64_t x) {
+  while (x >= 0x80) {
+    putc((int)(x & 0x7F) | 0x80, out);
+    x >>= 7;
+  }
+  putc((int)x, out);
+}
+
+static void put_name (const char *name) {
+  size_t len = strlen(name);
+  put_number(len);
+  fwrite(name, 1, len, out);
+}
+
+static void put_tag (aint tag) {
+  for (size_t i = 0; i < tags_number; ++i) {
+    if (tags[i] == tag) { return; }
+  }
+  if (tags_number == tags_capacity) {
+    tags_capacity = MAX(2 * tags_capacity, 64);
+    tags          = realloc(tags, tags_capacity * sizeof(aint));
+    if (tags == NULL) {
+      perror("ERROR: gc_heap_dump: realloc failed\n");
+      exit(1);
+    }
+  }
+  tags[tags_number++] = tag;
+  putc(HEAP_DUMP_TAG, out);
+  put_number((uint64_t)tag);
+  put_name(de_hash(tag));
+}
+
+static void put_object (size_t *header) {
+  void     *obj  = get_object_content_ptr(header);
+  lama_type type = get_type_header_ptr(header);
+  aint      tag  = type == SEXP || type == CONS ? sexp_tag(obj) : 0;
+  if (tag != 0) { put_tag(tag); }
+
+  size_t refs = 0;
+  for (obj_field_iterator it = ptr_field_begin_iterator(header); !field_is_done_iterator(&it);
+       obj_next_ptr_field_iterator(&it)) {
+    if (!UNBOXED(field_load(it.cur_field))) { ++refs; }
+  }
+  putc(HEAP_DUMP_OBJECT, out);
+  put_number((size_t)obj);
+  put_number(type);
+  put_number((uint64_t)tag);
+  put_number(LEN(TO_DATA(obj)->data_header));
+  put_number(obj_size_header_ptr(header));
+  put_number(refs);
+  for (obj_field_iterator it = ptr_field_begin_iterator(header); !field_is_done_iterator(&it);
+       obj_next_ptr_field_iterator(&it)) {
+    aint field = field_load(it.cur_field);
+    if (!UNBOXED(field)) { put_number((size_t)field); }
+  }
+}
+
+void gc_heap_dump (const char *path) {
+  // only reachable objects are left
+  gc_collect(0);
+
+  out = fopen(path, "wb");
+  if (out == NULL) {
+    perror("ERROR: gc_heap_dump: fopen failed\n");
+    return;
+  }
+  setvbuf(out, NULL, _IOFBF, 1 << 20);
+  tags_number = 0;
+  fwrite(HEAP_DUMP_MAGIC, 1, strlen(HEAP_DUMP_MAGIC), out);
+
+  const root_region *regions;
+  size_t             n = gc_root_regions(&regions);
+  for (size_t r = 0; r < n; ++r) {
+    putc(HEAP_DUMP_REGION, out);
+    put_number(r);
+    put_name(gc_root_region_name(r));
+  }
+
+  for (heap_iterator it = heap_begin_iterator(); !heap_is_done_iterator(&it); heap_next_obj_iterator(&it)) {
+    put_object(it.current);
+  }
+  los_for_each(put_object);
+
+  for (size_t r = 0; r < n; ++r) {
+    for (size_t *p = regions[r].begin; p < regions[r].end; ++p) {
+      if (!is_valid_heap_pointer((size_t *)*p)) { continue; }
+      putc(HEAP_DUMP_ROOT, out);
+      put_number(r);
+      put_number(p - gc_root_region_base(r));
+      put_number(*p);
+    }
+  }
+  putc(HEAP_DUMP_END, out);
+  if (fclose(out) != 0) { perror("ERROR: gc_heap_dump: fclose failed\n"); }
+}
+
+void gc_heap_dump_at_safepoint (void) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s.%zu", dump_path, ++signal_dumps_written);
+  gc_heap_dump(path);
+  // signals which have come during this dump are served by the same dump
+  signal_dumps_written = signal_dumps_requested;
+}
+
+void gc_heap_dump_at_exit (void) {
+  if (dump_path != NULL) { gc_heap_dump(dump_path); }
+}
@@ -0,0 +1,319 @@
+#define _GNU_SOURCE 1
+
+#include "gc.h"
+
+#include "runtime_common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define LINES_PER_BLOCK (GC_IMMIX_BLOCK_SIZE / GC_IMMIX_LINE_SIZE)
+#define NO_BLOCK ((size_t)-1)
+
+typedef enum { BLOCK_FREE, BLOCK_RECYCLABLE, BLOCK_FULL, BLOCK_EVACUATING } block_state;
+
+static unsigned char *line_marks;     // one byte per line of the reservation
+static unsigned char *block_states;   // block_state of every block of the reservation
+static unsigned short *block_holes;   // number of holes found by the last sweep
+static size_t          blocks_total;      // blocks in the reservation
+static size_t          blocks_used    = 0;   // high-water mark: blocks above it have never been used
+static size_t          blocks_occupied = 0;   // blocks which are not free
+static size_t          blocks_budget   = GC_IMMIX_MIN_BLOCKS;
+
+// the hole the main allocator bumps in, and the next place to look for holes
+static size_t *cursor = NULL, *limit = NULL;
+static size_t  recycle_block = 0, recycle_line = 0;
+// medium objects which do not fit the current hole go to a separate free block
+static size_t *overflow_cursor = NULL, *overflow_limit = NULL;
+// during collection survivors of evacuated blocks are copied to free blocks
+static size_t *evacuation_cursor = NULL, *evacuation_limit = NULL;
+
+static inline size_t *block_begin (size_t b) { return heap.begin + b * GC_IMMIX_BLOCK_SIZE; }
+
+static inline size_t block_of (void *p) { return ((size_t *)p - heap.begin) / GC_IMMIX_BLOCK_SIZE; }
+
+static inline size_t line_of (void *p) { return ((size_t *)p - heap.begin) / GC_IMMIX_LINE_SIZE; }
+
+void immix_init (void) {
+  blocks_total = GC_IMMIX_RESERVE_SIZE / GC_IMMIX_BLOCK_SIZE;
+  heap.begin   = mmap(NULL,
+                    WORDS_TO_BYTES(GC_IMMIX_RESERVE_SIZE),
+                    PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                    -1,
+                    0);
+  line_marks   = mmap(NULL,
+                    blocks_total * LINES_PER_BLOCK,
+                    PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                    -1,
+                    0);
+  if (heap.begin == MAP_FAILED || line_marks == MAP_FAILED) {
+    perror("ERROR: immix_init: mmap failed\n");
+    exit(1);
+  }
+  block_states = calloc(blocks_total, sizeof(unsigned char));
+  block_holes  = calloc(blocks_total, sizeof(unsigned short));
+  if (block_states == NULL || block_holes == NULL) {
+    perror("ERROR: immix_init: calloc failed\n");
+    exit(1);
+  }
+  heap.end     = heap.begin + GC_IMMIX_RESERVE_SIZE;
+  heap.size    = GC_IMMIX_RESERVE_SIZE;
+  heap.current = heap.begin;
+  // every allocation goes to immix_alloc
+  gc_alloc_limit = heap.begin;
+}
+
+// ============================================================================
+//                                Blocks
+// ============================================================================
+
+// blocks below it are known to be in use
+static size_t free_hint = 0;
+
+// takes n consecutive free blocks, returns the first of them or NO_BLOCK
+static size_t take_free_blocks (size_t n, bool ignore_budget) {
+  if (!ignore_budget && blocks_occupied + n > blocks_budget) { return NO_BLOCK; }
+  size_t run = 0, b = free_hint, first_free = NO_BLOCK;
+  for (; b < blocks_used && run < n; ++b) {
+    if (block_states[b] != BLOCK_FREE) {
+      run = 0;
+      continue;
+    }
+    first_free = first_free == NO_BLOCK ? b : first_free;
+    ++run;
+  }
+  if (run < n) {
+    // the run is continued by never used blocks
+    if (blocks_used + (n - run) > blocks_total) { return NO_BLOCK; }
+    b           = blocks_used + (n - run);
+    blocks_used = b;
+    heap.current = block_begin(blocks_used);
+  }
+  size_t first = b - n;
+  if (first_free == NO_BLOCK || first_free == first) { free_hint = first + n; }
+  memset(block_states + first, BLOCK_FULL, n);
+  blocks_occupied += n;
+  return first;
+}
+
+// finds the next hole for the main allocator
+static bool next_hole (void) {
+  for (; recycle_block < blocks_used; ++recycle_block, recycle_line = 0) {
+    if (block_states[recycle_block] != BLOCK_RECYCLABLE) { continue; }
+    unsigned char *marks = line_marks + recycle_block * LINES_PER_BLOCK;
+    while (recycle_line < LINES_PER_BLOCK && marks[recycle_line]) { ++recycle_line; }
+    if (recycle_line == LINES_PER_BLOCK) { continue; }
+    size_t start = recycle_line;
+    while (recycle_line < LINES_PER_BLOCK && !marks[recycle_line]) { ++recycle_line; }
+    cursor = block_begin(recycle_block) + start * GC_IMMIX_LINE_SIZE;
+    limit  = block_begin(recycle_block) + recycle_line * GC_IMMIX_LINE_SIZE;
+    return true;
+  }
+  size_t b = take_free_blocks(1, false);
+  if (b == NO_BLOCK) { return false; }
+  cursor = block_begin(b);
+  limit  = cursor + GC_IMMIX_BLOCK_SIZE;
+  return true;
+}
+
+static inline void *bump (size_t **cur, size_t *lim, size_t size) {
+  if (*cur == NULL || *cur + size > lim) { return NULL; }
+  void *p = *cur;
+  *cur += size;
+  return p;
+}
+
+static void *try_alloc (size_t size) {
+  void *p;
+  if (size > GC_IMMIX_BLOCK_SIZE) {
+    size_t b = take_free_blocks((size + GC_IMMIX_BLOCK_SIZE - 1) / GC_IMMIX_BLOCK_SIZE, false);
+    return b == NO_BLOCK ? NULL : block_begin(b);
+  }
+  if ((p = bump(&cursor, limit, size)) != NULL) { return p; }
+  if (size > GC_IMMIX_LINE_SIZE) {
+    if ((p = bump(&overflow_cursor, overflow_limit, size)) != NULL) { return p; }
+    size_t b = take_free_blocks(1, false);
+    if (b == NO_BLOCK) { return NULL; }
+    overflow_cursor = block_begin(b);
+    overflow_limit  = overflow_cursor + GC_IMMIX_BLOCK_SIZE;
+    return bump(&overflow_cursor, overflow_limit, size);
+  }
+  while (next_hole()) {
+    if ((p = bump(&cursor, limit, size)) != NULL) { return p; }
+  }
+  return NULL;
+}
+
+// ============================================================================
+//                               Collection
+// ============================================================================
+
+// telemetry only: words allocated since the last collection and live after it
+static size_t allocated_words  = 0;
+static size_t live_words_after = 0;
+
+static void **live         = NULL;   // every object marked during the current collection
+static size_t live_size     = 0;
+static size_t live_capacity = 0;
+
+static void live_push (void *obj) {
+  if (live_size == live_capacity) {
+    live_capacity = MAX(2 * live_capacity, 1024);
+    live          = realloc(live, live_capacity * sizeof(void *));
+    if (live == NULL) {
+      perror("ERROR: live_push: realloc failed\n");
+      exit(1);
+    }
+  }
+  live[live_size++] = obj;
+}
+
+static int compare_holes (const void *a, const void *b) {
+  return (int)block_holes[*(const size_t *)b] - (int)block_holes[*(const size_t *)a];
+}
+
+// marks the most fragmented recyclable blocks as evacuation candidates
+static void select_evacuation_candidates (void) {
+  size_t *candidates = malloc(blocks_used * sizeof(size_t) + 1);
+  size_t  n          = 0;
+  if (candidates == NULL) { return; }
+  for (size_t b = 0; b < blocks_used; ++b) {
+    if (block_states[b] == BLOCK_RECYCLABLE && block_holes[b] >= GC_IMMIX_DEFRAG_MIN_HOLES) {
+      candidates[n++] = b;
+    }
+  }
+  qsort(candidates, n, sizeof(size_t), compare_holes);
+  n = MIN(n, blocks_occupied * GC_IMMIX_DEFRAG_PERCENT / 100);
+  for (size_t i = 0; i < n; ++i) { block_states[candidates[i]] = BLOCK_EVACUATING; }
+  free(candidates);
+}
+
+static size_t *evacuation_alloc (size_t size) {
+  size_t *p = bump(&evacuation_cursor, evacuation_limit, size);
+  if (p != NULL) { return p; }
+  size_t b = take_free_blocks(1, true);
+  if (b == NO_BLOCK) { return NULL; }
+  evacuation_cursor = block_begin(b);
+  evacuation_limit  = evacuation_cursor + GC_IMMIX_BLOCK_SIZE;
+  return bump(&evacuation_cursor, evacuation_limit, size);
+}
+
+static void mark_lines (size_t *header, size_t words) {
+  memset(line_marks + line_of(header), 1, line_of(header + words - 1) - line_of(header) + 1);
+}
+
+// marks (or evacuates) the object referenced from slot, slot is updated if the object moves
+static void trace_slot (void **slot) {
+  void *obj = *slot;
+  if (!is_valid_heap_pointer(obj)) { return; }
+  if (is_forwarded(obj)) {
+    // already evacuated
+    *slot = get_object_content_ptr(forwarded_to(obj));
+    return;
+  }
+  if (is_marked(obj)) { return; }
+
+  size_t *header = get_obj_header_ptr(obj);
+  size_t  words  = BYTES_TO_WORDS(obj_size_header_ptr(header));
+  size_t *to     = NULL;
+  if (block_states[block_of(header)] == BLOCK_EVACUATING && (to = evacuation_alloc(words)) != NULL) {
+    memcpy(to, header, WORDS_TO_BYTES(words));
+    forward_to(obj, to);
+    header = to;
+    obj    = get_object_content_ptr(to);
+    *slot  = obj;
+  }
+  mark_object(obj);
+  mark_lines(header, words);
+  live_push(obj);
+}
+
+static void trace_roots (void) {
+  const root_region *regions;
+  size_t             n = gc_root_regions(&regions);
+  for (size_t r = 0; r < n; ++r) {
+    for (size_t *p = regions[r].begin; p < regions[r].end; ++p) { trace_slot((void **)p); }
+  }
+  for (int i = 0; i < extra_roots.current_free; ++i) { trace_slot(extra_roots.roots[i]); }
+}
+
+static void sweep_blocks (void) {
+  blocks_occupied = 0;
+  for (size_t b = 0; b < blocks_used; ++b) {
+    unsigned char *marks  = line_marks + b * LINES_PER_BLOCK;
+    size_t         marked = 0, holes = 0;
+    for (size_t l = 0; l < LINES_PER_BLOCK; ++l) {
+      marked += marks[l];
+      holes += !marks[l] && (l == 0 || marks[l - 1]);
+    }
+    if (marked == 0) {
+      // release memory of blocks which have just become empty
+      if (block_states[b] != BLOCK_FREE) {
+        madvise(block_begin(b), WORDS_TO_BYTES(GC_IMMIX_BLOCK_SIZE), MADV_DONTNEED);
+      }
+      block_states[b] = BLOCK_FREE;
+      continue;
+    }
+    block_states[b] = marked == LINES_PER_BLOCK ? BLOCK_FULL : BLOCK_RECYCLABLE;
+    block_holes[b]  = holes;
+    ++blocks_occupied;
+  }
+  while (blocks_used > 0 && block_states[blocks_used - 1] == BLOCK_FREE) { --blocks_used; }
+  heap.current = block_begin(blocks_used);
+  free_hint    = 0;
+}
+
+void immix_collect (void) {
+  gc_stats_cycle_begin(live_words_after + allocated_words);
+  allocated_words = 0;
+  select_evacuation_candidates();
+  memset(line_marks, 0, blocks_used * LINES_PER_BLOCK);
+  evacuation_cursor = evacuation_limit = NULL;
+
+  live_size = 0;
+  trace_roots();
+  for (size_t i = 0; i < live_size; ++i) {
+    for (obj_field_iterator it = ptr_field_begin_iterator(get_obj_header_ptr(live[i]));
+         !field_is_done_iterator(&it);
+         obj_next_ptr_field_iterator(&it)) {
+      trace_slot((void **)it.cur_field);
+    }
+  }
+  size_t live_words = 0;
+  for (size_t i = 0; i < live_size; ++i) {
+    if (gc_stats_enabled) { live_words += BYTES_TO_WORDS(obj_size_row_ptr(live[i])); }
+    unmark_object(live[i]);
+  }
+
+  sweep_blocks();
+  blocks_budget = MAX(GC_IMMIX_MIN_BLOCKS, blocks_occupied * EXTRA_ROOM_HEAP_COEFFICIENT);
+
+  cursor = limit = NULL;
+  overflow_cursor = overflow_limit = NULL;
+  recycle_block = recycle_line = 0;
+  live_words_after = live_words;
+  gc_stats_cycle_end(live_words, blocks_budget * GC_IMMIX_BLOCK_SIZE);
+}
+
+void *immix_alloc (size_t size) {
+  void *p = try_alloc(size);
+  if (p == NULL) {
+    immix_collect();
+    p = try_alloc(size);
+  }
+  // live objects do not leave enough room, so the heap grows
+  while (p == NULL && blocks_budget < blocks_total) {
+    blocks_budget = MIN(blocks_budget * EXTRA_ROOM_HEAP_COEFFICIENT, blocks_total);
+    p             = try_alloc(size);
+  }
+  if (p == NULL) {
+    fprintf(stderr, "ERROR: immix_alloc: heap reservation of %zu words is exhausted\n", (size_t)GC_IMMIX_RESERVE_SIZE);
+    exit(1);
+  }
+  allocated_words += size;
+  return p;
+}
@@ -0,0 +1,274 @@
+#define _GNU_SOURCE 1
+
+#include "gc.h"
+
+#include "runtime_common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+bool gc_marking_active = false;
+
+typedef enum { IDLE, MARKING, SWEEPING } cycle_state;
+
+static cycle_state state = IDLE;
+// words allocated since the end of the previous cycle
+static size_t      allocated_words = 0;
+// heap.current at the moment the slow path has been left last time
+static size_t     *last_current    = NULL;
+
+// how often (in processed objects) the pause budget is checked
+#define BUDGET_CHECK_INTERVAL 256
+
+static struct timespec slice_deadline (void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  t.tv_sec += gc_pause_budget_us / 1000000;
+  t.tv_nsec += (gc_pause_budget_us % 1000000) * 1000;
+  if (t.tv_nsec >= 1000000000) {
+    t.tv_sec += 1;
+    t.tv_nsec -= 1000000000;
+  }
+  return t;
+}
+
+static bool budget_is_over (size_t *work, const struct timespec *deadline) {
+  if (++*work % BUDGET_CHECK_INTERVAL != 0) { return false; }
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec > deadline->tv_sec
+         || (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
+}
+
+// ============================================================================
+//                               Free lists
+// ============================================================================
+// A free chunk is formatted as an array (so the heap stays parsable by the
+// heap iterator), its forward_address keeps the next chunk of the same list.
+
+static size_t *free_lists[GC_FREE_LIST_CLASSES];
+
+#define CHUNK_HEADER_WORDS (DATA_HEADER_SZ / sizeof(size_t))
+
+static inline size_t chunk_class (size_t words) { return MIN(words, GC_FREE_LIST_CLASSES - 1); }
+
+static inline size_t chunk_words (size_t *chunk) {
+  return CHUNK_HEADER_WORDS + LEN(((data *)chunk)->data_header);
+}
+
+static inline size_t **chunk_next (size_t *chunk) {
+#ifdef LAMA_COMPACT_HEADERS
+  // incremental mode is rejected with compact headers by __init: chunks have no word for the link
+  fprintf(stderr, "ERROR: chunk_next: free lists need forward_address\n");
+  exit(1);
+#else
+  return (size_t **)&((data *)chunk)->forward_address;
+#endif
+}
+
+static void add_free_chunk (size_t *chunk, size_t words) {
+  data *d        = (data *)chunk;
+  d->data_header = ARRAY_TAG | ((words - CHUNK_HEADER_WORDS) << 3);
+  size_t c       = chunk_class(words);
+  *chunk_next(chunk) = free_lists[c];
+  free_lists[c]      = chunk;
+}
+
+static void clear_free_lists (void) { memset(free_lists, 0, sizeof(free_lists)); }
+
+static void *free_list_alloc (size_t size) {
+  for (size_t c = chunk_class(size); c < GC_FREE_LIST_CLASSES; ++c) {
+    for (size_t **link = &free_lists[c]; *link != NULL; link = chunk_next(*link)) {
+      size_t *chunk = *link;
+      size_t  words = chunk_words(chunk);
+      // a remainder has to be big enough to be a chunk itself
+      if (words == size || words >= size + CHUNK_HEADER_WORDS) {
+        *link = *chunk_next(chunk);
+        if (words > size) { add_free_chunk(chunk + size, words - size); }
+        return chunk;
+      }
+      // all chunks of a small class have the same size
+      if (c != GC_FREE_LIST_CLASSES - 1) { break; }
+    }
+  }
+  return NULL;
+}
+
+// ============================================================================
+//                                Marking
+// ============================================================================
+
+static void **mark_stack          = NULL;
+static size_t mark_stack_size     = 0;
+static size_t mark_stack_capacity = 0;
+// words occupied by black and grey objects
+static size_t live_words          = 0;
+
+static void mark_stack_push (void *obj) {
+  if (mark_stack_size == mark_stack_capacity) {
+    mark_stack_capacity = MAX(2 * mark_stack_capacity, 1024);
+    mark_stack          = realloc(mark_stack, mark_stack_capacity * sizeof(void *));
+    if (mark_stack == NULL) {
+      perror("ERROR: mark_stack_push: realloc failed\n");
+      exit(1);
+    }
+  }
+  mark_stack[mark_stack_size++] = obj;
+}
+
+void gc_shade (void *obj) {
+  if (!is_valid_heap_pointer(obj) || is_marked(obj)) { return; }
+  mark_object(obj);
+  live_words += BYTES_TO_WORDS(obj_size_row_ptr(obj));
+  mark_stack_push(obj);
+}
+
+static void scan_object (void *obj) {
+  for (obj_field_iterator it = ptr_field_begin_iterator(get_obj_header_ptr(obj));
+       !field_is_done_iterator(&it);
+       obj_next_ptr_field_iterator(&it)) {
+    gc_shade((void *)field_load(it.cur_field));
+  }
+}
+
+static void shade_roots (void) {
+  const root_region *regions;
+  size_t             n = gc_root_regions(&regions);
+  for (size_t r = 0; r < n; ++r) {
+    for (size_t *p = regions[r].begin; p < regions[r].end; ++p) { gc_shade(*(void **)p); }
+  }
+  for (int i = 0; i < extra_roots.current_free; ++i) { gc_shade(*extra_roots.roots[i]); }
+}
+
+static void start_marking (void) {
+  gc_stats_cycle_begin(heap.current - heap.begin);
+  state             = MARKING;
+  live_words        = 0;
+  gc_marking_active = true;
+  shade_roots();
+}
+
+static size_t *sweep_cursor = NULL;
+static size_t *sweep_limit  = NULL;
+
+static void start_sweeping (void) {
+  state        = SWEEPING;
+  sweep_cursor = heap.begin;
+  sweep_limit  = heap.current;
+  // every chunk of the old lists is dead, the sweep will find it again
+  clear_free_lists();
+}
+
+// the final pause: stack and extra roots are not barriered, so they are
+// rescanned, after that the rest of grey objects is traced
+static void finish_marking (size_t additional_size, bool force_compaction) {
+  uint64_t t = gc_stats_now();
+  shade_roots();
+  while (mark_stack_size > 0) { scan_object(mark_stack[--mark_stack_size]); }
+  gc_marking_active = false;
+  gc_stats_phase(GC_PHASE_MARK, t);
+
+  size_t used = heap.current - heap.begin;
+  if (force_compaction || (used - live_words) * 100 >= used * GC_FRAGMENTATION_THRESHOLD) {
+    compact_phase(additional_size);
+    clear_free_lists();
+    state           = IDLE;
+    allocated_words = 0;
+    gc_stats_cycle_end(heap.current - heap.begin, heap.size);
+  } else {
+    start_sweeping();
+  }
+}
+
+static void mark_slice (size_t additional_size) {
+  struct timespec deadline = slice_deadline();
+  size_t          work     = 0;
+  while (mark_stack_size > 0) {
+    if (budget_is_over(&work, &deadline)) { return; }
+    scan_object(mark_stack[--mark_stack_size]);
+  }
+  finish_marking(additional_size, false);
+}
+
+// ============================================================================
+//                                Sweeping
+// ============================================================================
+// Objects between sweep_cursor and sweep_limit are either black (live) or
+// white (dead): allocation during sweeping only takes chunks behind the cursor
+// or bumps heap.current, which is above sweep_limit.
+
+static void sweep (const struct timespec *deadline) {
+  size_t  work = 0;
+  size_t *run  = NULL;   // beginning of the current sequence of dead objects
+  while (sweep_cursor < sweep_limit && (deadline == NULL || !budget_is_over(&work, deadline))) {
+    void *content = get_object_content_ptr(sweep_cursor);
+    if (is_marked(content)) {
+      unmark_object(content);
+      if (run != NULL) {
+        add_free_chunk(run, sweep_cursor - run);
+        run = NULL;
+      }
+    } else if (run == NULL) {
+      run = sweep_cursor;
+    }
+    sweep_cursor += BYTES_TO_WORDS(obj_size_header_ptr(sweep_cursor));
+  }
+  if (run != NULL) { add_free_chunk(run, sweep_cursor - run); }
+  if (sweep_cursor >= sweep_limit) {
+    state           = IDLE;
+    allocated_words = 0;
+    gc_stats_cycle_end(live_words, heap.size);
+  }
+}
+
+// ============================================================================
+//                               Allocation
+// ============================================================================
+
+static void *collect_and_alloc (size_t size) {
+  if (state == SWEEPING) {
+    sweep(NULL);
+    void *p = free_list_alloc(size);
+    if (p != NULL) { return p; }
+  }
+  if (state == IDLE) { start_marking(); }
+  finish_marking(size, true);
+  return gc_alloc_on_existing_heap(size);
+}
+
+void *incremental_alloc (size_t size) {
+  if (last_current != NULL && heap.current >= last_current) {
+    allocated_words += heap.current - last_current;
+  }
+  gc_alloc_limit = heap.end;
+
+  // a started cycle opens the pause itself
+  if (state != IDLE) { gc_stats_pause_begin(); }
+  switch (state) {
+    case IDLE:
+      if (allocated_words * 100 >= heap.size * GC_INCREMENTAL_TRIGGER) { start_marking(); }
+      break;
+    case MARKING: mark_slice(size); break;
+    case SWEEPING: {
+      struct timespec deadline = slice_deadline();
+      sweep(&deadline);
+      break;
+    }
+  }
+  gc_stats_pause_end();
+
+  void *p = gc_alloc_on_existing_heap(size);
+  if (p == NULL) { p = free_list_alloc(size); }
+  if (p == NULL) {
+    gc_stats_pause_begin();
+    p = collect_and_alloc(size);
+    gc_stats_pause_end();
+  }
+  allocated_words += size;
+
+  last_current   = heap.current;
+  gc_alloc_limit = MIN(heap.end, heap.current + GC_INCREMENTAL_STEP);
+  return p;
+}
@@ -0,0 +1,142 @@
+#define _GNU_SOURCE 1
+
+#include "gc.h"
+
+#include "runtime_common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+bool gc_los_enabled = false;
+
+typedef struct {
+  size_t *header;
+  size_t  size;   // in words
+} large_object;
+
+// sorted by address
+static large_object *objects          = NULL;
+static size_t        objects_number   = 0;
+static size_t        objects_capacity = 0;
+// bounds of all large objects, to reject most of pointers without a search
+static size_t *lowest = NULL, *highest = NULL;
+
+// words of large objects which have survived the last collection and allocated since then
+static size_t live_words      = 0;
+static size_t allocated_words = 0;
+
+// marked objects whose fields are still to be marked
+static void **grey          = NULL;
+static size_t grey_size     = 0;
+static size_t grey_capacity = 0;
+
+static void insert_object (size_t *header, size_t size) {
+  if (objects_number == objects_capacity) {
+    objects_capacity = MAX(2 * objects_capacity, 64);
+    objects          = realloc(objects, objects_capacity * sizeof(large_object));
+    if (objects == NULL) {
+      perror("ERROR: los_alloc: realloc failed\n");
+      exit(1);
+    }
+  }
+  size_t i = objects_number;
+  for (; i > 0 && objects[i - 1].header > header; --i) { objects[i] = objects[i - 1]; }
+  objects[i] = (large_object){header, size};
+  ++objects_number;
+  lowest  = objects[0].header;
+  highest = objects[objects_number - 1].header + objects[objects_number - 1].size;
+}
+
+void *los_alloc (size_t size) {
+  // large objects do not take heap space, so they trigger collections on their own
+  if (allocated_words + size > MAX(live_words, heap.size)) {
+    if (gc_safepoints_enabled) {
+      gc_requested = true;
+    } else {
+      gc_collect(0);
+    }
+  }
+  size_t *header = mmap(NULL, WORDS_TO_BYTES(size), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (header == MAP_FAILED) {
+    perror("ERROR: los_alloc: mmap failed\n");
+    exit(1);
+  }
+  insert_object(header, size);
+  allocated_words += size;
+  return header;
+}
+
+bool los_contains (const void *p) {
+  if (objects_number == 0 || (size_t *)p <= lowest || (size_t *)p > highest) { return false; }
+  // the last object which starts below p
+  size_t lo = 0, hi = objects_number;
+  while (hi - lo > 1) {
+    size_t mid = (lo + hi) / 2;
+    if (objects[mid].header < (size_t *)p) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  return p == get_object_content_ptr(objects[lo].header);
+}
+
+void los_mark (void *obj) {
+  if (is_marked(obj)) { return; }
+  mark_object(obj);
+  if (grey_size == grey_capacity) {
+    grey_capacity = MAX(2 * grey_capacity, 64);
+    grey          = realloc(grey, grey_capacity * sizeof(void *));
+    if (grey == NULL) {
+      perror("ERROR: los_mark: realloc failed\n");
+      exit(1);
+    }
+  }
+  grey[grey_size++] = obj;
+}
+
+void *los_next_grey (void) { return grey_size == 0 ? NULL : grey[--grey_size]; }
+
+void los_for_each_live (void (*f) (size_t *header)) {
+  for (size_t i = 0; i < objects_number; ++i) {
+    if (is_marked(get_object_content_ptr(objects[i].header))) { f(objects[i].header); }
+  }
+}
+
+void los_for_each (void (*f) (size_t *header)) {
+  for (size_t i = 0; i < objects_number; ++i) { f(objects[i].header); }
+}
+
+void los_fix_references (memory_chunk *old_heap) {
+  for (size_t i = 0; i < objects_number; ++i) {
+    if (is_marked(get_object_content_ptr(objects[i].header))) {
+      fix_object_references(old_heap, objects[i].header);
+    }
+  }
+}
+
+size_t los_words (void) { return live_words + allocated_words; }
+
+void los_sweep (void) {
+  size_t n   = 0;
+  live_words = 0;
+  for (size_t i = 0; i < objects_number; ++i) {
+    void *obj = get_object_content_ptr(objects[i].header);
+    if (is_marked(obj)) {
+      unmark_object(obj);
+      live_words += objects[i].size;
+      objects[n++] = objects[i];
+    } else if (munmap(objects[i].header, WORDS_TO_BYTES(objects[i].size)) < 0) {
+      perror("ERROR: los_sweep: munmap failed\n");
+      exit(1);
+    }
+  }
+  objects_number  = n;
+  allocated_words = 0;
+  if (n > 0) {
+    lowest  = objects[0].header;
+    highest = objects[n - 1].header + objects[n - 1].size;
+  }
+}
@@ -0,0 +1,479 @@
+#define _GNU_SOURCE 1
+
+#include "gc.h"
+
+#include "runtime_common.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+size_t gc_threads = 1;
+
+// ============================================================================
+//                              Worker pool
+// ============================================================================
+// Helper threads are started lazily on the first parallel phase and then sleep
+// on 'workers_wakeup' between phases. The thread which has triggered GC is
+// always worker 0.
+
+static pthread_t       workers[GC_MAX_THREADS];
+static size_t          workers_started = 0;
+static pthread_mutex_t workers_lock    = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  workers_wakeup  = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  workers_done    = PTHREAD_COND_INITIALIZER;
+static size_t          job_generation  = 0;
+static size_t          jobs_finished   = 0;
+static gc_worker_job   current_job     = NULL;
+static void           *current_job_arg = NULL;
+
+static void *worker_loop (void *arg) {
+  size_t id   = (size_t)arg;
+  size_t seen = 0;
+
+  pthread_mutex_lock(&workers_lock);
+  while (true) {
+    while (job_generation == seen) { pthread_cond_wait(&workers_wakeup, &workers_lock); }
+    seen              = job_generation;
+    gc_worker_job job = current_job;
+    void         *a   = current_job_arg;
+    pthread_mutex_unlock(&workers_lock);
+
+    job(id, a);
+
+    pthread_mutex_lock(&workers_lock);
+    if (++jobs_finished == workers_started) { pthread_cond_signal(&workers_done); }
+  }
+  return NULL;
+}
+
+static void start_workers (void) {
+  while (workers_started + 1 < gc_threads) {
+    size_t id = workers_started + 1;
+    if (pthread_create(&workers[id], NULL, worker_loop, (void *)id) != 0) {
+      perror("ERROR: start_workers: pthread_create failed\n");
+      exit(1);
+    }
+    pthread_detach(workers[id]);
+    ++workers_started;
+  }
+}
+
+void gc_workers_run (gc_worker_job job, void *arg) {
+  pthread_mutex_lock(&workers_lock);
+  start_workers();
+  current_job     = job;
+  current_job_arg = arg;
+  jobs_finished   = 0;
+  ++job_generation;
+  pthread_cond_broadcast(&workers_wakeup);
+  pthread_mutex_unlock(&workers_lock);
+
+  job(0, arg);
+
+  pthread_mutex_lock(&workers_lock);
+  while (jobs_finished < workers_started) { pthread_cond_wait(&workers_done, &workers_lock); }
+  pthread_mutex_unlock(&workers_lock);
+}
+
+bool gc_parallel_enabled (void) {
+  return gc_mode == GC_MODE_STW && gc_compaction == GC_COMPACTION_SLIDING && gc_threads > 1
+         && heap.size >= GC_PARALLEL_MIN_HEAP_SIZE;
+}
+
+// ============================================================================
+//                       Chase-Lev work-stealing deque
+// ============================================================================
+// Owner pushes and pops at 'bottom', thieves take from 'top'. When the circular
+// buffer is full the owner replaces it by a twice bigger one; the old buffer
+// may still be read by a concurrent thief, so it is only freed after the phase.
+
+#define DEQUE_INITIAL_CAPACITY 1024
+
+typedef struct deque_buffer {
+  long                 capacity;
+  struct deque_buffer *retired;   // previous (smaller) buffer, freed after marking
+  void                *items[];
+} deque_buffer;
+
+typedef struct {
+  long          top;
+  long          bottom;
+  deque_buffer *buffer;
+  char          padding[64];   // keep deques of different workers in different cache lines
+} work_deque;
+
+static work_deque deques[GC_MAX_THREADS];
+
+static deque_buffer *deque_buffer_new (long capacity) {
+  deque_buffer *b = malloc(sizeof(deque_buffer) + capacity * sizeof(void *));
+  if (b == NULL) {
+    perror("ERROR: deque_buffer_new: malloc failed\n");
+    exit(1);
+  }
+  b->capacity = capacity;
+  b->retired  = NULL;
+  return b;
+}
+
+static void deque_init (work_deque *d) {
+  if (d->buffer == NULL) { d->buffer = deque_buffer_new(DEQUE_INITIAL_CAPACITY); }
+  d->top    = 0;
+  d->bottom = 0;
+}
+
+static void deque_release_retired (work_deque *d) {
+  deque_buffer *b = d->buffer->retired;
+  d->buffer->retired = NULL;
+  while (b != NULL) {
+    deque_buffer *next = b->retired;
+    free(b);
+    b = next;
+  }
+}
+
+static void *buffer_get (deque_buffer *b, long i) {
+  return __atomic_load_n(&b->items[i & (b->capacity - 1)], __ATOMIC_RELAXED);
+}
+
+static void buffer_put (deque_buffer *b, long i, void *obj) {
+  __atomic_store_n(&b->items[i & (b->capacity - 1)], obj, __ATOMIC_RELAXED);
+}
+
+static deque_buffer *deque_grow (work_deque *d, long top, long bottom) {
+  deque_buffer *old = d->buffer;
+  deque_buffer *b   = deque_buffer_new(old->capacity * 2);
+  for (long i = top; i < bottom; ++i) { buffer_put(b, i, buffer_get(old, i)); }
+  b->retired = old;
+  __atomic_store_n(&d->buffer, b, __ATOMIC_RELEASE);
+  return b;
+}
+
+static void deque_push (work_deque *d, void *obj) {
+  long          bottom = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+  long          top    = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+  deque_buffer *b      = __atomic_load_n(&d->buffer, __ATOMIC_RELAXED);
+  if (bottom - top > b->capacity - 1) { b = deque_grow(d, top, bottom); }
+  buffer_put(b, bottom, obj);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&d->bottom, bottom + 1, __ATOMIC_RELAXED);
+}
+
+static void *deque_pop (work_deque *d) {
+  long          bottom = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+  deque_buffer *b      = __atomic_load_n(&d->buffer, __ATOMIC_RELAXED);
+  __atomic_store_n(&d->bottom, bottom, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  long top = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+
+  if (top > bottom) {
+    __atomic_store_n(&d->bottom, bottom + 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+  void *obj = buffer_get(b, bottom);
+  if (top == bottom) {
+    // the last element, compete with thieves for it
+    if (!__atomic_compare_exchange_n(
+            &d->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+      obj = NULL;
+    }
+    __atomic_store_n(&d->bottom, bottom + 1, __ATOMIC_RELAXED);
+  }
+  return obj;
+}
+
+static void *deque_steal (work_deque *d) {
+  long top = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  long bottom = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+  if (top >= bottom) { return NULL; }
+
+  deque_buffer *b   = __atomic_load_n(&d->buffer, __ATOMIC_ACQUIRE);
+  void         *obj = buffer_get(b, top);
+  if (!__atomic_compare_exchange_n(
+          &d->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+    return NULL;
+  }
+  return obj;
+}
+
+static bool deque_is_empty (work_deque *d) {
+  return __atomic_load_n(&d->top, __ATOMIC_ACQUIRE)
+         >= __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+}
+
+// ============================================================================
+//                            Parallel marking
+// ============================================================================
+
+typedef struct {
+  const root_region *regions;
+  size_t             regions_number;
+  size_t             idle_workers;
+} mark_job;
+
+// one bit per heap word, set for the header of every marked object; used by parallel compaction
+static size_t *live_bitmap = NULL;
+
+static inline void set_live_bit (void *obj) {
+  size_t i = (size_t *)get_obj_header_ptr(obj) - heap.begin;
+  __atomic_fetch_or(&live_bitmap[i / WORD_BITS], (size_t)1 << (i % WORD_BITS), __ATOMIC_RELAXED);
+}
+
+static inline void shade (work_deque *own, void *obj) {
+  if (is_valid_heap_pointer(obj) && try_mark_object(obj)) {
+    // large objects are scanned, but they are not compacted
+    if (!los_contains(obj)) { set_live_bit(obj); }
+    deque_push(own, obj);
+  }
+}
+
+static void scan_object (work_deque *own, void *obj) {
+  for (obj_field_iterator it = ptr_field_begin_iterator(get_obj_header_ptr(obj));
+       !field_is_done_iterator(&it);
+       obj_next_ptr_field_iterator(&it)) {
+    shade(own, (void *)field_load(it.cur_field));
+  }
+}
+
+// worker 'id' of 'n' takes the id-th part of [begin, end)
+static void scan_root_slice (work_deque *own, size_t id, size_t n, size_t *begin, size_t *end) {
+  if (begin >= end) { return; }
+  size_t  chunk = (end - begin + n - 1) / n;
+  size_t *from  = begin + MIN(chunk * id, (size_t)(end - begin));
+  size_t *to    = begin + MIN(chunk * (id + 1), (size_t)(end - begin));
+  for (size_t *p = from; p < to; ++p) { shade(own, *(void **)p); }
+}
+
+static void *steal_work (size_t id) {
+  for (size_t i = 1; i < gc_threads; ++i) {
+    void *obj = deque_steal(&deques[(id + i) % gc_threads]);
+    if (obj != NULL) { return obj; }
+  }
+  return NULL;
+}
+
+static bool some_work_left (void) {
+  for (size_t i = 0; i < gc_threads; ++i) {
+    if (!deque_is_empty(&deques[i])) { return true; }
+  }
+  return false;
+}
+
+static void mark_worker (size_t id, void *arg) {
+  mark_job   *job = arg;
+  work_deque *own = &deques[id];
+
+  for (size_t r = 0; r < job->regions_number; ++r) {
+    scan_root_slice(own, id, gc_threads, job->regions[r].begin, job->regions[r].end);
+  }
+  for (int i = id; i < extra_roots.current_free; i += gc_threads) {
+    shade(own, *extra_roots.roots[i]);
+  }
+
+  while (true) {
+    void *obj;
+    while ((obj = deque_pop(own)) != NULL || (obj = steal_work(id)) != NULL) {
+      scan_object(own, obj);
+    }
+
+    // termination: marking is over once every worker is idle, since only
+    // a working thread can make some deque non-empty
+    __atomic_add_fetch(&job->idle_workers, 1, __ATOMIC_SEQ_CST);
+    while (true) {
+      if (__atomic_load_n(&job->idle_workers, __ATOMIC_SEQ_CST) == gc_threads) { return; }
+      if (some_work_left()) {
+        __atomic_sub_fetch(&job->idle_workers, 1, __ATOMIC_SEQ_CST);
+        break;
+      }
+      sched_yield();
+    }
+  }
+}
+
+void parallel_mark_phase (void) {
+  mark_job job;
+  job.regions_number = gc_root_regions(&job.regions);
+  job.idle_workers   = 0;
+
+  live_bitmap = calloc((heap.current - heap.begin) / WORD_BITS + 1, sizeof(size_t));
+  if (live_bitmap == NULL) {
+    perror("ERROR: parallel_mark_phase: calloc failed\n");
+    exit(1);
+  }
+  for (size_t i = 0; i < gc_threads; ++i) { deque_init(&deques[i]); }
+  gc_workers_run(mark_worker, &job);
+  for (size_t i = 0; i < gc_threads; ++i) { deque_release_retired(&deques[i]); }
+}
+
+// ============================================================================
+//                          Parallel compaction
+// ============================================================================
+// Heap is split into GC_REGION_SIZE-word regions. Live objects of a region are
+// found via 'live_bitmap' (one bit per heap word, set for the header of every
+// object marked by parallel_mark_phase), so dead objects are never visited.
+//  1. regions are summarised in parallel: number of live words in each of them;
+//  2. a prefix sum over the summaries gives every region its destination;
+//  3. forward addresses are assigned and then references are fixed region by
+//     region in parallel;
+//  4. regions are claimed for moving in increasing order, and a region waits
+//     until every lower region with objects inside its destination range is
+//     moved, so no object is overwritten before it is copied (as in LISP2
+//     objects only slide down).
+
+typedef struct {
+  size_t live;      // live words whose headers are in the region
+  size_t dest;      // word offset (from heap.begin) of the first live object after compaction
+  size_t src_end;   // word offset of the end of the last live object of the region
+  bool   moved;
+} compaction_region;
+
+typedef struct {
+  compaction_region *regions;
+  size_t             regions_number;
+  size_t             next_region;
+  size_t             used;   // words of the heap covered by live_bitmap
+  memory_chunk      *old_heap;
+  const root_region *roots;
+  size_t             roots_number;
+} compaction_job;
+
+static compaction_job compaction;
+
+// returns offset of the first live object header in [from, to), or 'to' if there is none
+static size_t next_live (size_t from, size_t to) {
+  while (from < to) {
+    size_t word = live_bitmap[from / WORD_BITS] >> (from % WORD_BITS);
+    if (word != 0) { return MIN(from + __builtin_ctzl(word), to); }
+    from = (from / WORD_BITS + 1) * WORD_BITS;
+  }
+  return to;
+}
+
+static inline size_t region_begin (size_t r) { return r * GC_REGION_SIZE; }
+
+static inline size_t region_end (size_t r) {
+  return MIN((r + 1) * GC_REGION_SIZE, compaction.used);
+}
+
+static inline size_t claim_region (void) {
+  return __atomic_fetch_add(&compaction.next_region, 1, __ATOMIC_RELAXED);
+}
+
+static inline size_t live_object_words (size_t *header) {
+  return BYTES_TO_WORDS(obj_size_header_ptr(header));
+}
+
+static void summarise_worker (size_t id, void *arg) {
+  for (size_t r; (r = claim_region()) < compaction.regions_number;) {
+    compaction_region *region = &compaction.regions[r];
+    for (size_t i = next_live(region_begin(r), region_end(r)); i < region_end(r);
+         i = next_live(i + 1, region_end(r))) {
+      size_t sz = live_object_words(heap.begin + i);
+      region->live += sz;
+      region->src_end = i + sz;
+    }
+  }
+}
+
+static void forward_worker (size_t id, void *arg) {
+  for (size_t r; (r = claim_region()) < compaction.regions_number;) {
+    size_t free_ptr = compaction.regions[r].dest;
+    for (size_t i = next_live(region_begin(r), region_end(r)); i < region_end(r);
+         i = next_live(i + 1, region_end(r))) {
+      // forward address is responsible for object header pointer
+      set_forward_address(get_object_content_ptr(heap.begin + i), (size_t)(heap.begin + free_ptr));
+      free_ptr += live_object_words(heap.begin + i);
+    }
+  }
+}
+
+size_t parallel_compute_locations (void) {
+  compaction.used           = heap.current - heap.begin;
+  compaction.regions_number = (compaction.used + GC_REGION_SIZE - 1) / GC_REGION_SIZE;
+  compaction.regions        = calloc(MAX(compaction.regions_number, 1), sizeof(compaction_region));
+  if (compaction.regions == NULL) {
+    perror("ERROR: parallel_compute_locations: calloc failed\n");
+    exit(1);
+  }
+
+  compaction.next_region = 0;
+  gc_workers_run(summarise_worker, NULL);
+
+  size_t live_size = 0;
+  for (size_t r = 0; r < compaction.regions_number; ++r) {
+    compaction.regions[r].dest = live_size;
+    live_size += compaction.regions[r].live;
+  }
+
+  compaction.next_region = 0;
+  gc_workers_run(forward_worker, NULL);
+  // it will return number of words
+  return live_size;
+}
+
+static void update_worker (size_t id, void *arg) {
+  for (size_t r; (r = claim_region()) < compaction.regions_number;) {
+    for (size_t i = next_live(region_begin(r), region_end(r)); i < region_end(r);
+         i = next_live(i + 1, region_end(r))) {
+      fix_object_references(compaction.old_heap, heap.begin + i);
+    }
+  }
+
+  for (size_t r = 0; r < compaction.roots_number; ++r) {
+    size_t *begin = compaction.roots[r].begin, *end = compaction.roots[r].end;
+    if (begin >= end) { continue; }
+    size_t chunk = (end - begin + gc_threads - 1) / gc_threads;
+    scan_and_fix_region(compaction.old_heap,
+                        begin + MIN(chunk * id, (size_t)(end - begin)),
+                        begin + MIN(chunk * (id + 1), (size_t)(end - begin)));
+  }
+  if (id == 0) { scan_and_fix_region_roots(compaction.old_heap); }
+}
+
+void parallel_update_references (memory_chunk *old_heap) {
+  compaction.old_heap     = old_heap;
+  compaction.roots_number = gc_root_regions(&compaction.roots);
+  compaction.next_region  = 0;
+  gc_workers_run(update_worker, NULL);
+}
+
+static void wait_for_sources (size_t r) {
+  for (size_t j = r; j-- > 0;) {
+    compaction_region *lower = &compaction.regions[j];
+    if (lower->live == 0) { continue; }
+    // src_end grows with region number, so lower regions are out of the way as well
+    if (lower->src_end <= compaction.regions[r].dest) { return; }
+    while (!__atomic_load_n(&lower->moved, __ATOMIC_ACQUIRE)) { sched_yield(); }
+  }
+}
+
+static void relocate_worker (size_t id, void *arg) {
+  for (size_t r; (r = claim_region()) < compaction.regions_number;) {
+    compaction_region *region = &compaction.regions[r];
+    if (region->live != 0) {
+      wait_for_sources(r);
+      size_t *to = heap.begin + region->dest;
+      for (size_t i = next_live(region_begin(r), region_end(r)); i < region_end(r);
+           i = next_live(i + 1, region_end(r))) {
+        size_t sz = obj_size_header_ptr(heap.begin + i);
+        memmove(to, heap.begin + i, sz);
+        unmark_object(get_object_content_ptr(to));
+        to += BYTES_TO_WORDS(sz);
+      }
+    }
+    __atomic_store_n(&region->moved, true, __ATOMIC_RELEASE);
+  }
+}
+
+void parallel_physically_relocate (memory_chunk *old_heap) {
+  compaction.next_region = 0;
+  gc_workers_run(relocate_worker, NULL);
+
+  free(compaction.regions);
+  free(live_bitmap);
+  compaction.regions = NULL;
+  live_bitmap        = NULL;
+}
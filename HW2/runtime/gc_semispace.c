@@ -0,0 +1,104 @@
+#define _GNU_SOURCE 1
+
+#include "gc.h"
+
+#include "runtime_common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// size of the current mapping, it is bigger than heap.size: to-space is
+// reserved with room for growth, but only heap.size words of it are used
+static size_t mapped_size = 0;
+
+static size_t *map_space (size_t words) {
+  size_t *p = mmap(NULL,
+                   WORDS_TO_BYTES(words),
+                   PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                   -1,
+                   0);
+  if (p == MAP_FAILED) {
+    perror("ERROR: semispace: mmap failed\n");
+    exit(1);
+  }
+  return p;
+}
+
+void semispace_init (void) {
+  mapped_size    = MINIMUM_HEAP_CAPACITY;
+  heap.begin     = map_space(mapped_size);
+  heap.end       = heap.begin + MINIMUM_HEAP_CAPACITY;
+  heap.size      = MINIMUM_HEAP_CAPACITY;
+  heap.current   = heap.begin;
+  gc_alloc_limit = heap.end;
+}
+
+void semispace_shutdown (void) {
+  munmap(heap.begin, WORDS_TO_BYTES(mapped_size));
+  mapped_size = 0;
+}
+
+// ============================================================================
+//                                 Copying
+// ============================================================================
+// from-space is the heap at the start of the collection, 'free' is the
+// bump pointer of to-space. Copied objects are forwarded to their new
+// address, see forward_to.
+
+static memory_chunk from_space;
+static size_t      *free_ptr;
+
+static inline bool in_from_space (void *p) {
+  return !UNBOXED(p) && (size_t *)p > from_space.begin && (size_t *)p <= from_space.current;
+}
+
+static void evacuate (void **slot) {
+  void *obj = *slot;
+  if (!in_from_space(obj)) { return; }
+  if (!is_forwarded(obj)) {
+    size_t *header = get_obj_header_ptr(obj);
+    size_t  words  = BYTES_TO_WORDS(obj_size_header_ptr(header));
+    memcpy(free_ptr, header, WORDS_TO_BYTES(words));
+    forward_to(obj, free_ptr);
+    free_ptr += words;
+  }
+  *slot = get_object_content_ptr(forwarded_to(obj));
+}
+
+void semispace_collect (size_t additional_size) {
+  from_space              = heap;
+  size_t from_mapped_size = mapped_size;
+  // survivors fit into the used part of from-space, the rest is room for growth
+  mapped_size = (heap.current - heap.begin) * EXTRA_ROOM_HEAP_COEFFICIENT + additional_size;
+  mapped_size = MAX(MAX(mapped_size, heap.size), MINIMUM_HEAP_CAPACITY);
+  heap.begin  = map_space(mapped_size);
+  free_ptr    = heap.begin;
+
+  const root_region *regions;
+  size_t             n = gc_root_regions(&regions);
+  for (size_t r = 0; r < n; ++r) {
+    for (size_t *p = regions[r].begin; p < regions[r].end; ++p) { evacuate((void **)p); }
+  }
+  for (int i = 0; i < extra_roots.current_free; ++i) { evacuate(extra_roots.roots[i]); }
+
+  // to-space between heap.begin and scan is black, between scan and free_ptr is grey
+  for (size_t *scan = heap.begin; scan < free_ptr; scan += BYTES_TO_WORDS(obj_size_header_ptr(scan))) {
+    for (obj_field_iterator it = ptr_field_begin_iterator(scan); !field_is_done_iterator(&it);
+         obj_next_ptr_field_iterator(&it)) {
+      evacuate((void **)it.cur_field);
+    }
+  }
+
+  size_t live_size = free_ptr - heap.begin;
+  heap.size      = next_heap_capacity(live_size, additional_size);
+  heap.end       = heap.begin + heap.size;
+  heap.current   = free_ptr;
+  gc_alloc_limit = heap.end;
+  if (munmap(from_space.begin, WORDS_TO_BYTES(from_mapped_size)) < 0) {
+    perror("ERROR: semispace_collect: munmap failed\n");
+    exit(1);
+  }
+}
@@ -0,0 +1,205 @@
+#define _GNU_SOURCE 1
+
+#include "gc.h"
+
+#include "runtime_common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+bool gc_stats_enabled = false;
+
+typedef struct {
+  uint64_t pause_ns;       // all pauses of the cycle
+  uint64_t max_pause_ns;
+  size_t   pauses;         // 1 in stop-the-world modes
+  uint64_t phase_ns[GC_PHASES];
+  size_t   allocated_words;   // since the end of the previous cycle
+  size_t   live_words;
+  size_t   reclaimed_words;
+  size_t   heap_words;
+} cycle_record;
+
+static const char *const phase_names[GC_PHASES] = {
+    "mark", "compute_locations", "update_references", "physically_relocate"};
+
+static cycle_record *cycles          = NULL;
+static size_t        cycles_number   = 0;
+static size_t        cycles_capacity = 0;
+static size_t        pause_histogram[GC_STATS_PAUSE_BUCKETS];
+
+// NULL prints the summary to stderr
+static const char *json_path = NULL;
+
+static bool         in_cycle = false;
+static cycle_record current;
+static bool         in_pause = false;
+static uint64_t     pause_start;
+static size_t       used_before;
+static size_t       live_after_last = 0;
+
+static uint64_t clock_ns (void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static void report (void);
+
+void gc_stats_init (void) {
+  const char *value = getenv("LAMA_GC_STATS");
+  if (value == NULL || *value == 0) { return; }
+  json_path        = strcmp(value, "summary") == 0 ? NULL : value;
+  gc_stats_enabled = true;
+  atexit(report);
+}
+
+void gc_stats_cycle_begin (size_t used_words) {
+  if (!gc_stats_enabled) { return; }
+  memset(&current, 0, sizeof(current));
+  used_before             = used_words;
+  current.allocated_words = used_words > live_after_last ? used_words - live_after_last : 0;
+  in_cycle                = true;
+  gc_stats_pause_begin();
+}
+
+static size_t pause_bucket (uint64_t pause_ns);
+
+void gc_stats_pause_begin (void) {
+  if (!gc_stats_enabled || in_pause) { return; }
+  in_pause    = true;
+  pause_start = clock_ns();
+}
+
+void gc_stats_pause_end (void) {
+  if (!in_pause) { return; }
+  in_pause       = false;
+  uint64_t pause = clock_ns() - pause_start;
+  ++pause_histogram[pause_bucket(pause)];
+  // pauses outside of cycles are not expected, but they are still counted in the histogram
+  if (in_cycle) {
+    current.pause_ns += pause;
+    current.max_pause_ns = MAX(current.max_pause_ns, pause);
+    ++current.pauses;
+  }
+}
+
+uint64_t gc_stats_now (void) { return in_cycle ? clock_ns() : 0; }
+
+void gc_stats_phase (gc_phase phase, uint64_t since) {
+  if (in_cycle) { current.phase_ns[phase] += clock_ns() - since; }
+}
+
+static size_t pause_bucket (uint64_t pause_ns) {
+  size_t b = 0;
+  for (uint64_t us = pause_ns / 1000; us > 0 && b + 1 < GC_STATS_PAUSE_BUCKETS; us >>= 1) { ++b; }
+  return b;
+}
+
+void gc_stats_cycle_end (size_t live_words, size_t heap_words) {
+  if (!in_cycle) { return; }
+  gc_stats_pause_end();
+  in_cycle                = false;
+  current.live_words      = live_words;
+  current.reclaimed_words = used_before > live_words ? used_before - live_words : 0;
+  current.heap_words      = heap_words;
+  live_after_last         = live_words;
+
+  if (cycles_number == cycles_capacity) {
+    cycles_capacity = MAX(2 * cycles_capacity, 64);
+    cycles          = realloc(cycles, cycles_capacity * sizeof(cycle_record));
+    if (cycles == NULL) {
+      perror("ERROR: gc_stats_cycle_end: realloc failed\n");
+      exit(1);
+    }
+  }
+  cycles[cycles_number++] = current;
+}
+
+// ============================================================================
+//                                 Reports
+// ============================================================================
+
+static const char *collector_name (void) {
+  static const char *const names[] = {"lisp2", "immix", "semispace"};
+  return names[gc_collector];
+}
+
+static const char *mode_name (void) {
+  static const char *const names[] = {"stw", "incremental", "concurrent"};
+  return names[gc_mode];
+}
+
+static void write_summary (FILE *f) {
+  uint64_t total_pause = 0, max_pause = 0, phases[GC_PHASES] = {0};
+  size_t   allocated = 0, reclaimed = 0, pauses = 0;
+  for (size_t i = 0; i < cycles_number; ++i) {
+    total_pause += cycles[i].pause_ns;
+    max_pause = MAX(max_pause, cycles[i].max_pause_ns);
+    pauses += cycles[i].pauses;
+    allocated += cycles[i].allocated_words;
+    reclaimed += cycles[i].reclaimed_words;
+    for (size_t p = 0; p < GC_PHASES; ++p) { phases[p] += cycles[i].phase_ns[p]; }
+  }
+  fprintf(f, "GC statistics (%s, %s): %zu collections, %zu pauses\n", collector_name(), mode_name(), cycles_number,
+          pauses);
+  fprintf(f, "  total pause:     %.3f ms, max %.3f ms\n", total_pause / 1e6, max_pause / 1e6);
+  for (size_t p = 0; p < GC_PHASES; ++p) {
+    fprintf(f, "  %-20s %.3f ms\n", phase_names[p], phases[p] / 1e6);
+  }
+  fprintf(f, "  allocated:       %zu bytes\n", WORDS_TO_BYTES(allocated));
+  fprintf(f, "  reclaimed:       %zu bytes\n", WORDS_TO_BYTES(reclaimed));
+  if (cycles_number > 0) {
+    fprintf(f, "  live after last: %zu bytes\n", WORDS_TO_BYTES(cycles[cycles_number - 1].live_words));
+    fprintf(f, "  heap after last: %zu bytes\n", WORDS_TO_BYTES(cycles[cycles_number - 1].heap_words));
+  }
+  fprintf(f, "  pauses:\n");
+  for (size_t b = 0; b < GC_STATS_PAUSE_BUCKETS; ++b) {
+    if (pause_histogram[b] == 0) { continue; }
+    if (b + 1 == GC_STATS_PAUSE_BUCKETS) {
+      fprintf(f, "    >= %8lu us: %zu\n", 1ul << (b - 1), pause_histogram[b]);
+    } else {
+      fprintf(f, "    <  %8lu us: %zu\n", 1ul << b, pause_histogram[b]);
+    }
+  }
+}
+
+static void write_json (FILE *f) {
+  fprintf(f, "{\n  \"collector\": \"%s\",\n  \"mode\": \"%s\",\n  \"collections\": [", collector_name(), mode_name());
+  for (size_t i = 0; i < cycles_number; ++i) {
+    cycle_record *c = &cycles[i];
+    fprintf(f, "%s\n    {\"pause_ns\": %" PRIu64 ", \"max_pause_ns\": %" PRIu64 ", \"pauses\": %zu",
+            i == 0 ? "" : ",", c->pause_ns, c->max_pause_ns, c->pauses);
+    for (size_t p = 0; p < GC_PHASES; ++p) {
+      fprintf(f, ", \"%s_ns\": %" PRIu64, phase_names[p], c->phase_ns[p]);
+    }
+    fprintf(f,
+            ", \"allocated_bytes\": %zu, \"live_bytes\": %zu, \"reclaimed_bytes\": %zu, \"heap_bytes\": "
+            "%zu}",
+            WORDS_TO_BYTES(c->allocated_words),
+            WORDS_TO_BYTES(c->live_words),
+            WORDS_TO_BYTES(c->reclaimed_words),
+            WORDS_TO_BYTES(c->heap_words));
+  }
+  fprintf(f, "\n  ],\n  \"pause_histogram_us\": [");
+  for (size_t b = 0; b < GC_STATS_PAUSE_BUCKETS; ++b) {
+    fprintf(f, "%s%zu", b == 0 ? "" : ", ", pause_histogram[b]);
+  }
+  fprintf(f, "]\n}\n");
+}
+
+static void report (void) {
+  if (json_path == NULL) {
+    write_summary(stderr);
+    return;
+  }
+  FILE *f = fopen(json_path, "w");
+  if (f == NULL) {
+    perror("ERROR: gc_stats: fopen failed\n");
+    return;
+  }
+  write_json(f);
+  fclose(f);
+}
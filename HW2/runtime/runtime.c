@@ -56,6 +56,7 @@ void Lassert (void *f, char *s, ...) {
   while (0)
 
 extern void *Bsexp (aint* args, aint bn);
+extern void *Bcons (aint* args);
 extern aint   LtagHash (char *);
 
 void *global_sysargs;
@@ -64,7 +65,7 @@ void *global_sysargs;
 extern aint LkindOf (void *p) {
   if (UNBOXED(p)) return UNBOXED_TAG;
 
-  return TAG(TO_DATA(p)->data_header);
+  return KIND(TO_DATA(p)->data_header);
 }
 
 // Compare s-exprs tags
@@ -77,8 +78,8 @@ extern aint LcompareTags (void *p, void *q) {
   pd = TO_DATA(p);
   qd = TO_DATA(q);
 
-  if (TAG(pd->data_header) == SEXP_TAG && TAG(qd->data_header) == SEXP_TAG) {
-    return BOX((TO_SEXP(p)->tag) - (TO_SEXP(q)->tag));
+  if (KIND(pd->data_header) == SEXP_TAG && KIND(qd->data_header) == SEXP_TAG) {
+    return BOX(sexp_tag(p) - sexp_tag(q));
   } else {
     failure("not a sexpr in compareTags: %ld, %ld\n", TAG(pd->data_header), TAG(qd->data_header));
   }
@@ -92,8 +93,13 @@ void *Ls__Infix_58 (void** args) {
 
   PRE_GC();
 
-  aint bsexp_args[] = {(aint)args[0], (aint)args[1], LtagHash("cons")};
-  res = Bsexp(bsexp_args, BOX(3));
+  // Bcons expects its arguments on the stack scanned by GC
+  aint bcons_args[] = {(aint)args[1], (aint)args[0]};
+  push_extra_root((void**)&bcons_args[0]);
+  push_extra_root((void**)&bcons_args[1]);
+  res = Bcons(bcons_args);
+  pop_extra_root((void**)&bcons_args[1]);
+  pop_extra_root((void**)&bcons_args[0]);
 
   POST_GC();
 
@@ -239,6 +245,46 @@ extern aint LtagHash (char *s) {
   return BOX(h);
 }
 
+// interned constructor tags: 'sexp_tags' maps indices to tags, 'sexp_tag_slots' is an
+// open-addressing table which maps tags to indices (+ 1, zero marks a free slot)
+static aint  *sexp_tags             = NULL;
+static auint  sexp_tags_number      = 0;
+static auint *sexp_tag_slots        = NULL;
+static size_t sexp_tag_slots_number = 0;
+
+static size_t sexp_tag_slot (aint tag) {
+  size_t i = ((auint)tag * 0x9E3779B97F4A7C15ull) & (sexp_tag_slots_number - 1);
+  while (sexp_tag_slots[i] != 0 && sexp_tags[sexp_tag_slots[i] - 1] != tag) {
+    i = (i + 1) & (sexp_tag_slots_number - 1);
+  }
+  return i;
+}
+
+auint sexp_tag_index (aint tag) {
+  if (sexp_tag_slots_number != 0) {
+    size_t i = sexp_tag_slot(tag);
+    if (sexp_tag_slots[i] != 0) { return sexp_tag_slots[i] - 1; }
+  }
+  if (2 * (sexp_tags_number + 1) > sexp_tag_slots_number) {
+    // keeps the load factor below 1/2, the number of slots is a power of two
+    size_t number = MAX(2 * sexp_tag_slots_number, 64);
+    free(sexp_tag_slots);
+    sexp_tag_slots        = calloc(number, sizeof(auint));
+    sexp_tags             = realloc(sexp_tags, number / 2 * sizeof(aint));
+    sexp_tag_slots_number = number;
+    if (sexp_tag_slots == NULL || sexp_tags == NULL) { failure("sexp_tag_index: out of memory\n"); }
+    for (auint k = 0; k < sexp_tags_number; ++k) { sexp_tag_slots[sexp_tag_slot(sexp_tags[k])] = k + 1; }
+  }
+  sexp_tags[sexp_tags_number] = tag;
+  sexp_tag_slots[sexp_tag_slot(tag)] = ++sexp_tags_number;
+  return sexp_tags_number - 1;
+}
+
+aint sexp_tag (void *p) {
+  auint header = TO_DATA(p)->data_header;
+  return TAG(header) == CONS_TAG ? CONS_SEXP_TAG : sexp_tags[SEXP_TAG_INDEX(header)];
+}
+
 char *de_hash (aint n) {
   static char buf[MAX_SEXP_TAGLEN + 1] = {0, 0, 0, 0, 0, 0};
   char       *p      = (char *)BOX(NULL);
@@ -316,22 +362,22 @@ static void printValue (void *p) {
   if (UNBOXED(p)) {
     printStringBuf("%ld", UNBOX(p));
   } else {
-    if (!is_valid_heap_pointer(p)) {
+    if (!is_object_pointer(p)) {
       printStringBuf("0x%x", p);
       return;
     }
 
     a = TO_DATA(p);
 
-    switch (TAG(a->data_header)) {
+    switch (KIND(a->data_header)) {
       case STRING_TAG: printStringBuf("\"%s\"", a->contents); break;
 
       case CLOSURE_TAG: {
 
         printStringBuf("<closure ");
         for (i = 0; i < LEN(a->data_header); i++) {
-          if (i) printValue((void *)((aint *)a->contents)[i]);
-          else printStringBuf("0x%x", (void *)((aint *)a->contents)[i]);
+          if (i) printValue((void *)field_load(&FIELDS(a->contents)[i]));
+          else printStringBuf("0x%x", (void *)(aint)FIELDS(a->contents)[i]);
           if (i != LEN(a->data_header) - 1) printStringBuf(", ");
         }
         printStringBuf(">");
@@ -340,7 +386,7 @@ static void printValue (void *p) {
       case ARRAY_TAG: {
         printStringBuf("[");
         for (i = 0; i < LEN(a->data_header); i++) {
-          printValue((void *)((aint *)a->contents)[i]);
+          printValue((void *)field_load(&FIELDS(a->contents)[i]));
           if (i != LEN(a->data_header) - 1) printStringBuf(", ");
         }
         printStringBuf("]");
@@ -349,13 +395,13 @@ static void printValue (void *p) {
 
       case SEXP_TAG: {
         sexp *sa  = (sexp *)a;
-        char *tag = de_hash((aint)sa->tag);
+        char *tag = de_hash(sexp_tag(p));
         if (strcmp(tag, "cons") == 0) {
           sexp *sb = sa;
           printStringBuf("{");
           while (LEN(sb->data_header)) {
-            printValue((void *)((aint *)sb->contents)[0]);
-            aint list_next = ((aint *)sb->contents)[1];
+            printValue((void *)field_load(&FIELDS(sb->contents)[0]));
+            aint list_next = field_load(&FIELDS(sb->contents)[1]);
             if (!UNBOXED(list_next)) {
               printStringBuf(", ");
               sb = TO_SEXP(list_next);
@@ -368,7 +414,7 @@ static void printValue (void *p) {
           if (LEN(a->data_header)) {
             printStringBuf(" (");
             for (i = 0; i < LEN(sexp_a->data_header); i++) {
-              printValue((void *)((aint *)sexp_a->contents)[i]);
+              printValue((void *)field_load(&FIELDS(sexp_a->contents)[i]));
               if (i != LEN(sexp_a->data_header) - 1) printStringBuf(", ");
             }
             printStringBuf(")");
@@ -390,18 +436,18 @@ static void stringcat (void *p) {
   else {
     a = TO_DATA(p);
 
-    switch (TAG(a->data_header)) {
+    switch (KIND(a->data_header)) {
       case STRING_TAG: printStringBuf("%s", a->contents); break;
 
       case SEXP_TAG: {
-        char *tag = de_hash(TO_SEXP(p)->tag);
+        char *tag = de_hash(sexp_tag(p));
 
         if (strcmp(tag, "cons") == 0) {
           sexp *b = (sexp *)a;
 
           while (LEN(b->data_header)) {
-            stringcat((void *)((aint *)b->contents)[0]);
-            aint next_b = ((aint *)b->contents)[1];
+            stringcat((void *)field_load(&FIELDS(b->contents)[0]));
+            aint next_b = field_load(&FIELDS(b->contents)[1]);
             if (!UNBOXED(next_b)) {
               b = TO_SEXP(next_b);
             } else break;
@@ -456,9 +502,7 @@ extern void *Lsubstring (aint* args /*void *subj, aint p, aint l*/) {
 
     PRE_GC();
 
-    push_extra_root((void**)&args[0]);
     r = (data *)alloc_string(ll);
-    pop_extra_root((void**)&args[0]);
 
     char *r_contents = r->contents;
     strncpy(r_contents, (char *)args[0] + pp, ll);
@@ -512,8 +556,6 @@ extern aint LregexpMatch (regex_t *b, char *s, aint pos) {
   }
 }
 
-extern void *Bstring (aint* args);
-
 void *Lclone (aint* args /*void *p*/) {
   data *obj;
   void *res;
@@ -524,13 +566,12 @@ void *Lclone (aint* args /*void *p*/) {
   data *a = TO_DATA(args[0]);
   aint  t = TAG(a->data_header), l = LEN(a->data_header);
 
-  push_extra_root((void**)&args[0]);
   switch (t) {
-    case STRING_TAG: {
-      void* p = TO_DATA(args[0])->contents;
-      res = Bstring((aint*)&p);
+    case STRING_TAG:
+      obj = (data *)alloc_string(l);
+      memcpy(obj->contents, TO_DATA(args[0])->contents, l);
+      res = (void *)obj->contents;
       break;
-    }
 
     case ARRAY_TAG:
       obj = (data *)alloc_array(l);
@@ -549,9 +590,14 @@ void *Lclone (aint* args /*void *p*/) {
       res = (void *)obj->contents;
       break;
 
+    case CONS_TAG:
+      obj = (data *)alloc_cons();
+      memcpy(obj, TO_DATA(args[0]), sexp_size(2));
+      res = (void *)obj->contents;
+      break;
+
     default: failure("invalid data_header %ld in clone *****\n", t);
   }
-  pop_extra_root((void**)&args[0]);
 
   POST_GC();
   return res;
@@ -565,9 +611,9 @@ aint inner_hash (aint depth, auint acc, void *p) {
   if (depth > HASH_DEPTH) return acc;
 
   if (UNBOXED(p)) return HASH_APPEND(acc, UNBOX(p));
-  else if (is_valid_heap_pointer(p)) {
+  else if (is_object_pointer(p)) {
     data *a = TO_DATA(p);
-    aint  t = TAG(a->data_header), l = LEN(a->data_header), i;
+    aint  t = KIND(a->data_header), l = LEN(a->data_header), i;
 
     acc = HASH_APPEND(acc, t);
     acc = HASH_APPEND(acc, l);
@@ -585,24 +631,23 @@ aint inner_hash (aint depth, auint acc, void *p) {
       }
 
       case CLOSURE_TAG:
-        acc = HASH_APPEND(acc, ((void **)a->contents)[0]);
+        acc = HASH_APPEND(acc, FIELDS(a->contents)[0]);
         i   = 1;
         break;
 
       case ARRAY_TAG: i = 0; break;
 
       case SEXP_TAG: {
-        aint ta = TO_SEXP(p)->tag;
+        aint ta = sexp_tag(p);
         acc    = HASH_APPEND(acc, ta);
-        i      = 1;
-        ++l;
+        i      = 0;
         break;
       }
 
       default: failure("invalid data_header %ld in hash *****\n", t);
     }
 
-    for (; i < l; i++) acc = inner_hash(depth + 1, acc, ((void **)a->contents)[i]);
+    for (; i < l; i++) acc = inner_hash(depth + 1, acc, (void *)field_load(&FIELDS(a->contents)[i]));
 
     return (aint)acc;
   } else return HASH_APPEND(acc, p);
@@ -638,13 +683,12 @@ extern aint Lcompare (void *p, void *q) {
     else return BOX(-1);
   } else if (UNBOXED(q)) return BOX(1);
   else {
-    if (is_valid_heap_pointer(p)) {
-      if (is_valid_heap_pointer(q)) {
+    if (is_object_pointer(p)) {
+      if (is_object_pointer(q)) {
         data *a = TO_DATA(p), *b = TO_DATA(q);
-        aint   ta = TAG(a->data_header), tb = TAG(b->data_header);
+        aint   ta = KIND(a->data_header), tb = KIND(b->data_header);
         aint   la = LEN(a->data_header), lb = LEN(b->data_header);
         aint   i;
-        aint   shift = 0;
 
         COMPARE_AND_RETURN(ta, tb);
 
@@ -652,7 +696,7 @@ extern aint Lcompare (void *p, void *q) {
           case STRING_TAG: return BOX(strcmp(a->contents, b->contents));
 
           case CLOSURE_TAG:
-            COMPARE_AND_RETURN(((void **)a->contents)[0], ((void **)b->contents)[0]);
+            COMPARE_AND_RETURN((aint)FIELDS(a->contents)[0], (aint)FIELDS(b->contents)[0]);
             COMPARE_AND_RETURN(la, lb);
             i = 1;
             break;
@@ -663,11 +707,10 @@ extern aint Lcompare (void *p, void *q) {
             break;
 
           case SEXP_TAG: {
-            aint tag_a = TO_SEXP(p)->tag, tag_b = TO_SEXP(q)->tag;
+            aint tag_a = sexp_tag(p), tag_b = sexp_tag(q);
             COMPARE_AND_RETURN(tag_a, tag_b);
             COMPARE_AND_RETURN(la, lb);
-            i     = 0;
-            shift = 1;
+            i = 0;
             break;
           }
 
@@ -675,12 +718,13 @@ extern aint Lcompare (void *p, void *q) {
         }
 
         for (; i < la; i++) {
-          aint c = Lcompare(((void **)a->contents)[i + shift], ((void **)b->contents)[i + shift]);
+          aint c = Lcompare((void *)field_load(&FIELDS(a->contents)[i]),
+                            (void *)field_load(&FIELDS(b->contents)[i]));
           if (c != BOX(0)) return c;
         }
         return BOX(0);
       } else return BOX(-1);
-    } else if (is_valid_heap_pointer(q)) return BOX(1);
+    } else if (is_object_pointer(q)) return BOX(1);
     else return BOX(p - q);
   }
 }
@@ -696,14 +740,14 @@ extern void *Belem (void *p, aint i) {
 
   switch (TAG(a->data_header)) {
     case STRING_TAG: return (void *)BOX((char)a->contents[i]);
-    case SEXP_TAG: return (void *)((aint *)((sexp *)a)->contents)[i];
-    default: return (void *)((aint *)a->contents)[i];
+    default: return (void *)field_load(&FIELDS(a->contents)[i]);
   }
 }
 
 extern void *LmakeArray (aint length) {
   data *r;
-  aint   n, *p;
+  aint     n;
+  field_t *p;
 
   ASSERT_UNBOXED("makeArray:1", length);
 
@@ -712,8 +756,8 @@ extern void *LmakeArray (aint length) {
   n = UNBOX(length);
   r = (data *)alloc_array(n);
 
-  p = (aint *)r->contents;
-  while (n--) *p++ = BOX(0);
+  p = FIELDS(r->contents);
+  while (n--) field_store(p++, BOX(0));
 
   POST_GC();
 
@@ -729,6 +773,7 @@ extern void *LmakeString (aint length) {
   PRE_GC();
 
   r = (data *)alloc_string(n);   // '\0' in the end of the string is taken into account
+  memset(r->contents, 0, n);
 
   POST_GC();
 
@@ -741,11 +786,8 @@ extern void *Bstring (aint* args/*void *p*/) {
 
   PRE_GC();
 
-  push_extra_root((void**)&args[0]);
-  s = LmakeString(BOX(n));
-  pop_extra_root((void**)&args[0]);
-  char *s_contents = (char *)&TO_DATA(s)->contents;
-  strncpy(s_contents, (char*)args[0], n + 1);   // +1 because of '\0' in the end of C-strings
+  s = ((data *)alloc_string(n))->contents;
+  memcpy(s, (char*)args[0], n);   // '\0' in the end is written by alloc_string
 
   POST_GC();
 
@@ -762,10 +804,8 @@ extern void *Lstringcat (aint *args /* void* p */) {
   createStringBuf();
   stringcat((void*)args[0]);
 
-  push_extra_root((void**)&args[0]);
   void* content = stringBuf.contents;
   s = Bstring((aint*) &content);
-  pop_extra_root((void**)&args[0]);
 
   deleteStringBuf();
 
@@ -782,10 +822,8 @@ extern void *Lstring (aint* args /* void *p */) {
   createStringBuf();
   printValue((void*)args[0]);
 
-  push_extra_root((void**)&args[0]);
   void* content = stringBuf.contents;
   s = Bstring((aint*)&content);
-  pop_extra_root((void**)&args[0]);
 
   deleteStringBuf();
 
@@ -800,19 +838,12 @@ extern void *Bclosure (aint* args, aint bn) {
 
   PRE_GC();
 
-  for (aint i = 0; i < n; ++i) {
-    push_extra_root((void**)&args[i + 1]);
-  }
-
   r = (data *)alloc_closure(n + 1);
-  ((void **)r->contents)[0] = (void*) args[0];
+  // the code pointer is not a Lama value, so it is stored as it is
+  FIELDS(r->contents)[0] = (field_t)args[0];
 
   for (int i = 0; i < n; i++) {
-    ((aint *)r->contents)[n - i] = args[i + 1];
-  }
-
-  for (aint i = n - 1; i >= 0; --i) {
-    pop_extra_root((void**)&args[i + 1]);
+    field_store(&FIELDS(r->contents)[n - i], args[i + 1]);
   }
 
   POST_GC();
@@ -826,18 +857,10 @@ extern void *Barray (aint* args, aint bn) {
   
   PRE_GC();
 
-  for (aint i = 0; i < n; i++) {
-    push_extra_root((void**)&args[i]);
-  }
-
   r = (data *)alloc_array(n);
 
   for (int i = 0; i < n; i++) {
-    ((aint *)r->contents)[n - 1 - i] = args[i];
-  }
-
-  for (aint i = n - 1; i >= 0; --i) {
-    pop_extra_root((void**)&args[i]);
+    field_store(&FIELDS(r->contents)[n - 1 - i], args[i]);
   }
 
   POST_GC();
@@ -852,29 +875,35 @@ extern void *Bsexp (aint* args, aint bn) {
   sexp   *r;
   aint     n = UNBOX(bn);
 
+  if (n == 3 && UNBOX(args[0]) == CONS_SEXP_TAG) { return Bcons(&args[1]); }
+
   PRE_GC();
 
   aint fields_cnt = n - 1;
 
-  for (aint i = 0; i < fields_cnt; i++) {
-    push_extra_root((void**)&args[i]);
-  }
-
   r              = alloc_sexp(fields_cnt);
-  r->tag         = 0;
+  r->data_header = SEXP_HEADER(fields_cnt, sexp_tag_index(UNBOX(args[0])));
 
   for (int i = 0; i < fields_cnt; i++) {
-    ((auint *)r->contents)[i] = args[n - i - 1];
+    field_store(&FIELDS(r->contents)[i], args[n - i - 1]);
   }
 
-  r->tag = UNBOX(args[0]);
+  POST_GC();
+  return (void *)((data *)r)->contents;
+}
+
+// args are the tail and the head of the list, in this order
+extern void *Bcons (aint* args) {
+  data *r;
 
-  for (aint i = fields_cnt - 1; i >= 0; --i) {
-    pop_extra_root((void**)&args[i]);
-  }
+  PRE_GC();
+
+  r = (data *)alloc_cons();
+  field_store(&FIELDS(r->contents)[0], args[1]);
+  field_store(&FIELDS(r->contents)[1], args[0]);
 
   POST_GC();
-  return (void *)((data *)r)->contents;
+  return r->contents;
 }
 
 extern aint Btag (void *d, aint t, aint n) {
@@ -883,7 +912,8 @@ extern aint Btag (void *d, aint t, aint n) {
   if (UNBOXED(d)) return BOX(0);
   else {
     r = TO_DATA(d);
-    return (aint)BOX(TAG(r->data_header) == SEXP_TAG && TO_SEXP(d)->tag == UNBOX(t)
+    if (TAG(r->data_header) == CONS_TAG) { return BOX(UNBOX(t) == CONS_SEXP_TAG && UNBOX(n) == 2); }
+    return (aint)BOX(TAG(r->data_header) == SEXP_TAG && sexp_tag(d) == UNBOX(t)
                      && LEN(r->data_header) == UNBOX(n));
   }
 }
@@ -943,7 +973,7 @@ extern aint Bstring_tag_patt (void *x) {
 extern aint Bsexp_tag_patt (void *x) {
   if (UNBOXED(x)) return BOX(0);
 
-  return BOX(TAG(TO_DATA(x)->data_header) == SEXP_TAG);
+  return BOX(KIND(TO_DATA(x)->data_header) == SEXP_TAG);
 }
 
 extern void *Bsta (void *x, aint i, void *v) {
@@ -956,15 +986,14 @@ extern void *Bsta (void *x, aint i, void *v) {
         ((char *)x)[UNBOX(i)] = (char)UNBOX(v);
         break;
       }
-      case SEXP_TAG: {
-        ((aint *)((sexp *)d)->contents)[UNBOX(i)] = (aint)v;
-        break;
-      }
       default: {
-        ((aint *)x)[UNBOX(i)] = (aint)v;
+        field_t *field = &FIELDS(x)[UNBOX(i)];
+        gc_write_barrier((void *)field_load(field), v);
+        field_store(field, (aint)v);
       }
     }
   } else {
+    gc_write_barrier(*(void **)x, v);
     *(void **)x = v;
   }
 
@@ -994,11 +1023,7 @@ extern void * /*Lstrcat*/ Li__Infix_4343 (aint* args /* void *a, void *b */) {
 
   PRE_GC();
 
-  push_extra_root((void**)&args[0]);
-  push_extra_root((void**)&args[1]);
   d = alloc_string(LEN(da->data_header) + LEN(db->data_header));
-  pop_extra_root((void**)&args[1]);
-  pop_extra_root((void**)&args[0]);
 
   da = TO_DATA(args[0]);
   db = TO_DATA(args[1]);
@@ -1316,7 +1341,9 @@ extern void set_args (aint argc, char *argv[]) {
   push_extra_root((void **)&p);
 
   for (i = 0; i < n; i++) {
-    ((aint *)p)[i] = (aint)Bstring((aint*)&argv[i]);
+    // p may be moved by the allocation
+    aint s = (aint)Bstring((aint*)&argv[i]);
+    field_store(&FIELDS(p)[i], s);
   }
 
   pop_extra_root((void **)&p);
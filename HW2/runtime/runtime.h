@@ -25,8 +25,12 @@ extern aint Llength (void *p);
 extern void *Bstring (aint* args/*void *p*/);
 extern void *Belem(void *p, aint i);
 extern void *Bsta (void *x, aint i, void *v);
+// Barray, Bsexp, Bcons and Bclosure take their arguments from the stack scanned
+// by GC (the operand stack), so they stay valid over the allocation without
+// being registered as extra roots
 extern void *Barray (aint* args, aint bn);
 extern void *Bsexp (aint* args, aint bn);
+extern void *Bcons (aint* args);
 extern aint LtagHash (char *s);
 extern aint Btag (void *d, aint t, aint n);
 extern void *Lstring (aint* args /* void *p */);
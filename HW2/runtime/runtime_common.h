@@ -7,6 +7,11 @@
 // this flag makes GC behavior a bit different for testing purposes.
 //#define DEBUG_VERSION
 //#define FULL_INVARIANT_CHECKS
+// fields of objects are 32-bit: see field_t (has to be the same for the runtime and its users)
+//#define LAMA_COMPRESSED_REFS
+// objects have no forward_address: the header is data_header alone, see data
+// (has to be the same for the runtime and its users)
+//#define LAMA_COMPACT_HEADERS
 
 #if defined(__x86_64__) || defined(__ppc64__)
 #define X86_64
@@ -30,22 +35,51 @@ typedef uint32_t auint;  // adaptive unsigned int
 #define ARRAY_TAG 0x00000003
 #define SEXP_TAG 0x00000005
 #define CLOSURE_TAG 0x00000007
+#define CONS_TAG 0x00000002      // s-expression cons with two fields, see CONS_HEADER
 #define UNBOXED_TAG 0x00000009   // Not actually a data_header; used to return from LkindOf
 #ifdef X86_64
 #define LEN_MASK (UINT64_MAX^7)
 #else
 #define LEN_MASK (UINT32_MAX^7)
 #endif
-#define LEN(x) (ptrt)(((ptrt)x & LEN_MASK) >> 3)
 #define TAG(x) (x & 7)
-
+// data_header of an s-expression keeps the number of fields in the lower half
+// (from bit 3) and the index of its constructor tag (see sexp_tag) in the upper half
+#define SEXP_TAG_SHIFT (sizeof(auint) * CHAR_BIT / 2)
+#define SEXP_LEN_MASK (((((auint)1) << SEXP_TAG_SHIFT) - 1) & ~(auint)7)
+#define SEXP_HEADER(members, tag_index)                                                            \
+  (SEXP_TAG | ((auint)(members) << 3) | ((auint)(tag_index) << SEXP_TAG_SHIFT))
+#define SEXP_TAG_INDEX(x) ((auint)(x) >> SEXP_TAG_SHIFT)
+#define LEN(x) (ptrt)((((ptrt)x) & (TAG(x) == SEXP_TAG ? SEXP_LEN_MASK : LEN_MASK)) >> 3)
+// cons cells are s-expressions of their own kind: the constructor is implied, so the
+// data_header is the same for all of them
+#define CONS_HEADER (CONS_TAG | (2 << 3))
+#define CONS_SEXP_TAG 848787   // LtagHash("cons"), unboxed
+// kind of an object as seen by Lama programs: cons cells are s-expressions
+#define KIND(x) (TAG(x) == CONS_TAG ? SEXP_TAG : TAG(x))
+
+#ifdef LAMA_COMPACT_HEADERS
+#  define FORWARD_ADDRESS_SZ 0
+#else
+#  define FORWARD_ADDRESS_SZ sizeof(ptrt)
+#endif
 #ifndef DEBUG_VERSION
-#  define DATA_HEADER_SZ (sizeof(auint) + sizeof(ptrt))
+#  define DATA_HEADER_SZ (sizeof(auint) + FORWARD_ADDRESS_SZ)
 #else
-#  define DATA_HEADER_SZ (sizeof(auint) + sizeof(ptrt) + sizeof(auint))
+#  define DATA_HEADER_SZ (sizeof(auint) + FORWARD_ADDRESS_SZ + sizeof(auint))
 #endif
 
-#define MEMBER_SIZE sizeof(ptrt)
+#ifdef LAMA_COMPRESSED_REFS
+// a field of an array, s-expression or closure is either a boxed integer (which
+// has to fit 32 bits) or an offset of an object from heap.begin, see field_load
+typedef uint32_t field_t;
+#else
+typedef aint field_t;
+#endif
+
+#define MEMBER_SIZE sizeof(field_t)
+// fields of an array, s-expression or closure given by its contents
+#define FIELDS(x) ((field_t *)(x))
 
 #define TO_DATA(x) ((data *)((char *)(x)-DATA_HEADER_SZ))
 #define TO_SEXP(x) ((sexp *)((char *)(x)-DATA_HEADER_SZ))
@@ -70,9 +104,12 @@ typedef struct {
   size_t id;
 #endif
 
+#ifndef LAMA_COMPACT_HEADERS
   // last bit is used as MARK-BIT, the rest are used to store address where object should move
-  // last bit can be used because due to alignment we can assume that last two bits are always 0's
+  // last bit can be used because due to alignment we can assume that last two bits are always 0's.
+  // With compact headers GC keeps this in side tables instead, see is_marked in gc.c
   ptrt forward_address;
+#endif
   char   contents[];
 } data;
 
@@ -85,11 +122,18 @@ typedef struct {
   size_t id;
 #endif
 
+#ifndef LAMA_COMPACT_HEADERS
   // last bit is used as MARK-BIT, the rest are used to store address where object should move
-  // last bit can be used because due to alignment we can assume that last two bits are always 0's
+  // last bit can be used because due to alignment we can assume that last two bits are always 0's.
+  // With compact headers GC keeps this in side tables instead, see is_marked in gc.c
   ptrt forward_address;
-  auint   tag;
+#endif
   char   contents[];
 } sexp;
 
+// constructor tags are interned: headers of s-expressions refer to them by index
+auint sexp_tag_index (aint tag);
+// constructor tag (as computed by LtagHash, unboxed) of s-expression p
+aint  sexp_tag (void *p);
+
 #endif